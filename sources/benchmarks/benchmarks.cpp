@@ -0,0 +1,290 @@
+#include <QDataStream>
+#include <QFont>
+#include <QTextStream>
+#include <QTest>
+
+#include "../diagramviewer.hpp"
+#include "../latexParser.hpp"
+#include "../layout.hpp"
+#include "../particle.hpp"
+#include "../textimporter.hpp"
+#include "../topology.hpp"
+#include "diagramgenerator.hpp"
+
+//Run the "run_benchmarks" target to write the results to benchmarks.xml, or run the benchmarks executable directly with the usual QtTest options
+class Benchmarks: public QObject{
+    Q_OBJECT
+
+private slots:
+    void painterPath_data();
+    void painterPath();
+    void svgCode_data();
+    void svgCode();
+    void parseLatex_data();
+    void parseLatex();
+
+    void topology_data();
+    void topology();
+    void layout_data();
+    void layout();
+
+    void toSvg_data();
+    void toSvg();
+    void save_data();
+    void save();
+    void load_data();
+    void load();
+    void importText_data();
+    void importText();
+    void redrawAll_data();
+    void redrawAll();
+    void undoRedo_data();
+    void undoRedo();
+    void bulkEdit_data();
+    void bulkEdit();
+
+private:
+    static void addParticleTypes();
+    static void addDiagramSizes();
+};
+
+void Benchmarks::addParticleTypes(){
+    QTest::addColumn<int>("type");
+    QTest::addColumn<QString>("labelText");
+    const QList<std::pair<const char*, Particle::ParticleType>> types = {
+        {"Fermion", Particle::Fermion}, {"Photon", Particle::Photon}, {"WeakBoson", Particle::WeakBoson}, {"Gluon", Particle::Gluon},
+        {"Higgs", Particle::Higgs}, {"GenericBoson", Particle::GenericBoson}, {"Hadron", Particle::Hadron}, {"Vertex", Particle::Vertex}
+    };
+    for(const auto &[name, type]: types){
+        QTest::addRow("%s", name) << int(type) << QString();
+        QTest::addRow("%s with label", name) << int(type) << QString("\\bar{\\nu}_\\mu");
+    }
+}
+
+void Benchmarks::addDiagramSizes(){
+    QTest::addColumn<qsizetype>("particleCount");
+    for(qsizetype particleCount: {100, 1000, 10000}){
+        QTest::addRow("%lld particles", qlonglong(particleCount)) << particleCount;
+    }
+}
+
+void Benchmarks::painterPath_data(){
+    addParticleTypes();
+}
+
+void Benchmarks::painterPath(){
+    QFETCH(int, type);
+    QFETCH(QString, labelText);
+    //The geometry is cached in the particle, so a new particle is needed for each iteration
+    QBENCHMARK{
+        std::unique_ptr<Particle> particle = Particle::create(Particle::ParticleType(type), QPoint(0, 0), QPoint(300, 200));
+        particle->setLabelText(labelText);
+        particle->painterPath();
+    }
+}
+
+void Benchmarks::svgCode_data(){
+    addParticleTypes();
+}
+
+void Benchmarks::svgCode(){
+    QFETCH(int, type);
+    QFETCH(QString, labelText);
+    QBENCHMARK{
+        std::unique_ptr<Particle> particle = Particle::create(Particle::ParticleType(type), QPoint(0, 0), QPoint(300, 200));
+        particle->setLabelText(labelText);
+        particle->svgCode();
+    }
+}
+
+void Benchmarks::parseLatex_data(){
+    QTest::addColumn<QString>("latexCode");
+    QTest::addRow("plain") << QString("H");
+    QTest::addRow("superscript") << QString("e^-");
+    QTest::addRow("symbols") << QString("\\bar{\\nu}_\\mu");
+    QTest::addRow("long") << QString("\\pi^0 \\to \\gamma\\gamma + e^+e^-_{\\alpha\\beta} \\bar{q}_1 q_2");
+}
+
+void Benchmarks::parseLatex(){
+    QFETCH(QString, latexCode);
+    const QFont font("Arial");
+    QBENCHMARK{
+        ::parseLatex(latexCode, QPoint(0, 0), font, true);
+    }
+}
+
+void Benchmarks::topology_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::topology(){
+    //Build the index from scratch, then remove and reinsert a particle so that the connected components have to be recomputed
+    QFETCH(qsizetype, particleCount);
+    const Diagram diagram = generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount});
+    const Diagram::Entry &entry = *diagram.begin();
+    QBENCHMARK{
+        DiagramTopology topology(100);
+        topology.rebuild(diagram);
+        topology.componentCount();
+        topology.remove(entry.id);
+        topology.insert(entry.id, entry.particle);
+        topology.componentCount();
+    }
+}
+
+void Benchmarks::layout_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::layout(){
+    QFETCH(qsizetype, particleCount);
+    DiagramTopology topology(100);
+    topology.rebuild(generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount}));
+    QBENCHMARK{
+        const QHash<QPoint, QPoint> positions = layoutDiagram(topology);
+        QCOMPARE(positions.size(), topology.nodes().size());
+    }
+}
+
+void Benchmarks::toSvg_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::toSvg(){
+    QFETCH(qsizetype, particleCount);
+    DiagramViewer diagramViewer(nullptr);
+    diagramViewer.setDiagram(generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount}));
+    QBENCHMARK{
+        diagramViewer.toSvg();
+    }
+}
+
+void Benchmarks::save_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::save(){
+    QFETCH(qsizetype, particleCount);
+    const Diagram diagram = generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount});
+    QBENCHMARK{
+        QByteArray data;
+        QDataStream dataStream(&data, QIODevice::WriteOnly);
+        dataStream << diagram;
+    }
+}
+
+void Benchmarks::load_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::load(){
+    QFETCH(qsizetype, particleCount);
+    QByteArray data;
+    QDataStream writeStream(&data, QIODevice::WriteOnly);
+    writeStream << generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount});
+    QBENCHMARK{
+        QDataStream dataStream(data);
+        Diagram diagram;
+        dataStream >> diagram;
+        QCOMPARE(diagram.size(), particleCount);
+    }
+}
+
+void Benchmarks::importText_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::importText(){
+    QFETCH(qsizetype, particleCount);
+    const QStringList typeNames = {"fermion", "photon", "weakboson", "gluon", "higgs", "genericboson", "hadron", "vertex"};
+    QByteArray text;
+    QTextStream textStream(&text);
+    for(const Diagram::Entry &entry: generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount})){
+        const QPoint from = entry.particle->startingPoint(), to = entry.particle->endPoint();
+        textStream << typeNames[entry.type] << ' ' << from.x() << ',' << from.y();
+        if(entry.type != Particle::Vertex){
+            textStream << ' ' << to.x() << ',' << to.y();
+        }
+        if(!entry.particle->labelText().isEmpty()){
+            textStream << " \"" << entry.particle->labelText() << '"';
+        }
+        textStream << '\n';
+    }
+    textStream.flush();
+    QBENCHMARK{
+        const std::optional<Diagram> diagram = importDiagramText(text);
+        QCOMPARE(diagram.has_value() ? diagram->size() : -1, particleCount);
+    }
+}
+
+void Benchmarks::redrawAll_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::redrawAll(){
+    //Switch between two different diagrams so that the scene is actually rebuilt each time instead of reusing the existing items
+    QFETCH(qsizetype, particleCount);
+    const Diagram first = generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount, .seed = 1});
+    const Diagram second = generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount, .seed = 2});
+    DiagramViewer diagramViewer(nullptr);
+    QBENCHMARK{
+        diagramViewer.setDiagram(first);
+        diagramViewer.setDiagram(second);
+    }
+}
+
+void Benchmarks::undoRedo_data(){
+    QTest::addColumn<int>("editCount");
+    for(int editCount: {10, 100}){
+        QTest::addRow("%d edits", editCount) << editCount;
+    }
+}
+
+void Benchmarks::undoRedo(){
+    //The history can only be built through the editor's user interface, so draw particles with the mouse between points of a 10x10 grid
+    QFETCH(int, editCount);
+    DiagramViewer diagramViewer(nullptr);
+    diagramViewer.resize(1500, 1500);
+    diagramViewer.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&diagramViewer));
+    diagramViewer.centerOn(450, 450);
+    int edits = 0;
+    for(int from = 0; from < 100 && edits < editCount; from++){
+        for(int to = from + 1; to < 100 && edits < editCount; to++){
+            diagramViewer.startDrawing(Particle::Fermion);
+            QTest::mousePress(diagramViewer.viewport(), Qt::LeftButton, Qt::NoModifier, diagramViewer.mapFromScene(from % 10 * 100, from / 10 * 100));
+            QTest::mouseRelease(diagramViewer.viewport(), Qt::LeftButton, Qt::NoModifier, diagramViewer.mapFromScene(to % 10 * 100, to / 10 * 100));
+            edits++;
+        }
+    }
+    QCOMPARE(diagramViewer.diagram().size(), qsizetype(editCount));
+
+    QBENCHMARK{
+        for(int i = 0; i < editCount; i++){
+            diagramViewer.undo();
+        }
+        for(int i = 0; i < editCount; i++){
+            diagramViewer.redo();
+        }
+    }
+}
+
+void Benchmarks::bulkEdit_data(){
+    addDiagramSizes();
+}
+
+void Benchmarks::bulkEdit(){
+    QFETCH(qsizetype, particleCount);
+    DiagramViewer diagramViewer(nullptr);
+    diagramViewer.setDiagram(generateDiagram(DiagramGeneratorOptions{.particleCount = particleCount}));
+    diagramViewer.selectAll();
+    QBENCHMARK{
+        diagramViewer.moveSelectedParticles(QPoint(100, 0));
+        diagramViewer.editSelectedLabels("e^-");
+        diagramViewer.undo();
+        diagramViewer.selectAll();
+    }
+}
+
+QTEST_MAIN(Benchmarks)
+#include "benchmarks.moc"
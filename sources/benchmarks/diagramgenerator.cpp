@@ -0,0 +1,43 @@
+#include "diagramgenerator.hpp"
+
+#include <QRandomGenerator>
+#include <QStringList>
+
+Diagram generateDiagram(const DiagramGeneratorOptions &options){
+    static const QStringList labels = {"e^-", "e^+", "\\gamma", "\\mu^-", "\\bar{\\nu}_\\mu", "W^+", "Z^0", "g", "H", "u", "\\bar{d}", "p^+", "\\pi^0", "\\tau^-", "q_1", "\\bar{q}_2"};
+
+    int totalWeight = 0;
+    for(int weight: options.particleMix){
+        totalWeight += weight;
+    }
+
+    //Particles are laid out in connected chains the way they usually are in real diagrams, which matters for the file format since it stores coordinates relative to the previous particle
+    QRandomGenerator random(options.seed);
+    Diagram diagram;
+    QPoint previous;
+    const int maximumStep = 3;
+    while(diagram.size() < options.particleCount && totalWeight > 0){
+        int choice = random.bounded(totalWeight);
+        Particle::ParticleType type = Particle::Fermion;
+        for(auto it = options.particleMix.cbegin(); it != options.particleMix.cend(); it++){
+            if(choice < it.value()){
+                type = it.key();
+                break;
+            }
+            choice -= it.value();
+        }
+
+        const QPoint from = random.bounded(4) == 0 ? QPoint(random.bounded(-50, 50), random.bounded(-50, 50)) * options.gridSize : previous;
+        QPoint to = from;
+        while(to == from && type != Particle::Vertex){
+            to = from + QPoint(random.bounded(-maximumStep, maximumStep + 1), random.bounded(-maximumStep, maximumStep + 1)) * options.gridSize;
+        }
+        std::unique_ptr<Particle> particle = Particle::create(type, from, to);
+        if(random.generateDouble() < options.labelProbability){
+            particle->setLabelText(labels[random.bounded(int(labels.size()))]);
+        }
+        diagram.insert(std::move(particle));
+        previous = to;
+    }
+    return diagram;
+}
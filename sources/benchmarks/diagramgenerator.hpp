@@ -0,0 +1,23 @@
+#ifndef DIAGRAMGENERATOR_H
+#define DIAGRAMGENERATOR_H
+
+#include <QMap>
+
+#include "../diagram.hpp"
+#include "../particle.hpp"
+
+//Options for generating random diagrams to benchmark with. The particle mix gives the relative frequency of each particle type.
+struct DiagramGeneratorOptions{
+    qsizetype particleCount = 1000;
+    QMap<Particle::ParticleType, int> particleMix = {
+        {Particle::Fermion, 4}, {Particle::Photon, 2}, {Particle::WeakBoson, 1}, {Particle::Gluon, 2},
+        {Particle::Higgs, 1}, {Particle::GenericBoson, 1}, {Particle::Hadron, 1}, {Particle::Vertex, 3}
+    };
+    double labelProbability = 0.5;
+    int gridSize = 100;    //Endpoints are snapped to a grid of this size like in the editor
+    quint32 seed = 1;
+};
+
+Diagram generateDiagram(const DiagramGeneratorOptions &options);
+
+#endif // DIAGRAMGENERATOR_H
@@ -0,0 +1,161 @@
+#include "diagram.hpp"
+
+#include <QBuffer>
+#include <QPainter>
+
+#include "diagramfile.hpp"
+#include "trace.hpp"
+
+Diagram::ParticleId Diagram::insert(std::shared_ptr<const Particle> particle){
+    const ParticleId id = this->_nextId;
+    this->insert(id, std::move(particle));
+    return id;
+}
+
+void Diagram::insert(ParticleId id, std::shared_ptr<const Particle> particle){
+    this->_placementCounts[placement(*particle)]++;
+    this->_indices.insert(id, this->_entries.size());
+    this->_entries.append(Entry{id, particle->type(), std::move(particle)});
+    this->_nextId = qMax(this->_nextId, id + 1);
+}
+
+void Diagram::replace(ParticleId id, std::shared_ptr<const Particle> particle){
+    Entry &entry = this->_entries[this->_indices.value(id)];
+    this->removePlacement(*entry.particle);
+    this->_placementCounts[placement(*particle)]++;
+    entry.type = particle->type();
+    entry.particle = std::move(particle);
+}
+
+std::shared_ptr<const Particle> Diagram::remove(ParticleId id){
+    const auto it = this->_indices.find(id);
+    if(it == this->_indices.end()){
+        return nullptr;
+    }
+    //Move the last entry into the hole so that the entries stay contiguous
+    const qsizetype index = it.value();
+    this->_indices.erase(it);
+    std::shared_ptr<const Particle> toReturn = std::move(this->_entries[index].particle);
+    this->removePlacement(*toReturn);
+    if(index != this->_entries.size() - 1){
+        this->_entries[index] = std::move(this->_entries.last());
+        this->_indices[this->_entries[index].id] = index;
+    }
+    this->_entries.removeLast();
+    return toReturn;
+}
+
+void Diagram::clear(){
+    this->_entries.clear();
+    this->_indices.clear();
+    this->_placementCounts.clear();
+}
+
+void Diagram::reserve(qsizetype size){
+    this->_entries.reserve(size);
+    this->_indices.reserve(size);
+    this->_placementCounts.reserve(size);
+}
+
+bool Diagram::contains(ParticleId id) const{
+    return this->_indices.contains(id);
+}
+
+bool Diagram::contains(const Particle &particle) const{
+    return this->_placementCounts.contains(placement(particle));
+}
+
+std::shared_ptr<const Particle> Diagram::particle(ParticleId id) const{
+    const auto it = this->_indices.constFind(id);
+    return it == this->_indices.cend() ? nullptr : this->_entries[it.value()].particle;
+}
+
+qsizetype Diagram::size() const{
+    return this->_entries.size();
+}
+
+bool Diagram::isEmpty() const{
+    return this->_entries.isEmpty();
+}
+
+QList<Diagram::Entry>::const_iterator Diagram::begin() const{
+    return this->_entries.cbegin();
+}
+
+QList<Diagram::Entry>::const_iterator Diagram::end() const{
+    return this->_entries.cend();
+}
+
+Diagram::Placement Diagram::placement(const Particle &particle){
+    return Placement{particle.type(), particle.startingPoint(), particle.endPoint()};
+}
+
+void Diagram::removePlacement(const Particle &particle){
+    const auto it = this->_placementCounts.find(placement(particle));
+    if(--it.value() == 0){
+        this->_placementCounts.erase(it);
+    }
+}
+
+QDataStream &operator<<(QDataStream &dataStream, const Diagram &diagram){
+    writeDiagramFile(dataStream, diagram);
+    return dataStream;
+}
+
+QDataStream &operator>>(QDataStream &dataStream, Diagram &diagram){
+    diagram = Diagram();
+    readDiagramFile(dataStream, diagram);
+    return dataStream;
+}
+
+QRect Diagram::svgRect() const{
+    QRect toReturn;
+    bool isEmpty = true;
+    for(const Entry &entry: this->_entries){
+        toReturn |= entry.particle->boundingRect().toRect();
+        isEmpty = isEmpty && entry.type == Particle::Vertex && entry.particle->labelText().isEmpty();    //Vertices without labels aren't visible in exported images
+    }
+    if(isEmpty){
+        return QRect();
+    }
+    return toReturn.adjusted(-10, -10, 10, 10);
+}
+
+bool Diagram::writeSvg(QIODevice *device) const{
+    TRACE_SCOPE("Diagram::writeSvg");
+    //The size is known before anything is written, so each particle can be written as soon as it's generated instead of keeping the whole document in memory
+    const QRect rect = this->svgRect();
+    if(rect.isNull()){
+        return false;
+    }
+    bool ok = device->write(QString("<?xml version=\"1.0\"?><svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%1\" height=\"%2\" viewBox=\"%3 %4 %1 %2\"><rect x=\"%3\" y=\"%4\" width=\"%1\" height=\"%2\" fill=\"white\"/>").arg(rect.width()).arg(rect.height()).arg(rect.x()).arg(rect.y()).toUtf8()) != -1;
+    for(const Entry &entry: this->_entries){
+        ok = ok && device->write(entry.particle->svgCode().toUtf8()) != -1;
+    }
+    return ok && device->write("</svg>") != -1;
+}
+
+bool Diagram::render(QPainter *painter) const{
+    TRACE_SCOPE("Diagram::render");
+    //The painter's window is set to the exported area so that it fills the whole device
+    const QRect rect = this->svgRect();
+    if(rect.isNull()){
+        return false;
+    }
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->setWindow(rect);
+    painter->fillRect(rect, Qt::white);
+    for(const Entry &entry: this->_entries){
+        painter->fillPath(entry.particle->painterPath(), Qt::black);
+    }
+    return true;
+}
+
+QString Diagram::toSvg() const{
+    QBuffer buffer;
+    buffer.open(QBuffer::WriteOnly);
+    if(!this->writeSvg(&buffer)){
+        return "";
+    }
+    return QString::fromUtf8(buffer.data());
+}
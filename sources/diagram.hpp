@@ -0,0 +1,70 @@
+#ifndef DIAGRAM_H
+#define DIAGRAM_H
+
+#include <QDataStream>
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QPainter>
+
+#include <memory>
+
+#include "particle.hpp"
+
+//The particles of a diagram without any graphical items, so that it can be loaded and exported without a DiagramViewer (for example from worker threads).
+//Particles are stored contiguously and identified by IDs that stay the same for as long as the particle exists, even when other particles are removed.
+//Stored particles are never modified, to change a particle it's replaced by a modified copy, which allows copies of the diagram and the undo history to share particles.
+class Diagram{
+public:
+    using ParticleId = quint32;
+
+    struct Entry{
+        ParticleId id;
+        Particle::ParticleType type;
+        std::shared_ptr<const Particle> particle;
+    };
+
+    ParticleId insert(std::shared_ptr<const Particle> particle);
+    void insert(ParticleId id, std::shared_ptr<const Particle> particle);
+    void replace(ParticleId id, std::shared_ptr<const Particle> particle);
+    std::shared_ptr<const Particle> remove(ParticleId id);
+    void clear();
+    void reserve(qsizetype size);
+
+    bool contains(ParticleId id) const;
+    bool contains(const Particle &particle) const;
+    std::shared_ptr<const Particle> particle(ParticleId id) const;
+
+    qsizetype size() const;
+    bool isEmpty() const;
+    QList<Entry>::const_iterator begin() const;
+    QList<Entry>::const_iterator end() const;
+
+    QRect svgRect() const;
+    bool writeSvg(QIODevice *device) const;
+    bool render(QPainter *painter) const;
+    QString toSvg() const;
+
+    friend QDataStream &operator<<(QDataStream &dataStream, const Diagram &diagram);
+    friend QDataStream &operator>>(QDataStream &dataStream, Diagram &diagram);
+
+private:
+    //Particles of the same type between the same points are drawn over each other, they're counted by placement so that contains() doesn't go through the whole diagram
+    struct Placement{
+        Particle::ParticleType type;
+        QPoint from, to;
+        bool operator==(const Placement &other) const = default;
+    };
+    friend size_t qHash(const Placement &placement, size_t seed = 0){
+        return qHashMulti(seed, int(placement.type), placement.from, placement.to);
+    }
+    static Placement placement(const Particle &particle);
+    void removePlacement(const Particle &particle);
+
+    QList<Entry> _entries;
+    QHash<ParticleId, qsizetype> _indices;
+    QHash<Placement, qsizetype> _placementCounts;
+    ParticleId _nextId = 1;
+};
+
+#endif // DIAGRAM_H
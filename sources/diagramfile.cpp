@@ -0,0 +1,331 @@
+#include "diagramfile.hpp"
+
+#include <QBuffer>
+#include <QHash>
+#include <QIODevice>
+
+#include <iterator>
+
+#include "trace.hpp"
+
+constexpr quint32 magicNumber = 0x46444732;    //"FDG2"
+constexpr quint16 currentVersion = 2;
+constexpr quint8 labelChunk = 0xFF;    //Other chunk kinds are the values of Particle::ParticleType, so these values must never change
+constexpr quint8 compressedChunk = 0x01;
+constexpr int minimumCompressedSize = 64;    //Smaller chunks never get smaller when compressed because of qCompress's overhead
+constexpr qsizetype progressInterval = 1024;    //Number of decoded particles between two progress reports
+
+//The order in which particles are stored, which is also the order in which they're added to the scene when loaded
+constexpr Particle::ParticleType particleTypes[] = {Particle::Fermion, Particle::Photon, Particle::WeakBoson, Particle::Gluon, Particle::Higgs, Particle::Hadron, Particle::Vertex, Particle::GenericBoson};
+
+using Chunk = DiagramFileInfo::Chunk;
+
+void appendVarint(QByteArray *data, quint32 value){
+    while(value >= 0x80){
+        data->append(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    data->append(char(value));
+}
+
+bool readVarint(const char **data, const char *end, quint32 *value){
+    *value = 0;
+    for(int shift = 0; shift < 32 && *data != end; shift += 7){
+        const quint8 byte = quint8(*(*data)++);
+        *value |= quint32(byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            return true;
+        }
+    }
+    return false;
+}
+
+//Zigzag encoding so that small negative deltas also get small varints
+void appendSignedVarint(QByteArray *data, qint32 value){
+    appendVarint(data, (quint32(value) << 1) ^ quint32(value >> 31));
+}
+
+bool readSignedVarint(const char **data, const char *end, qint32 *value){
+    quint32 encoded;
+    if(!readVarint(data, end, &encoded)){
+        return false;
+    }
+    *value = qint32(encoded >> 1) ^ -qint32(encoded & 1);
+    return true;
+}
+
+QByteArray encodeParticles(const Diagram &diagram, Particle::ParticleType type, QHash<QString, quint32> *labelIndices, quint32 *count){
+    //Most particles start where the previous one ended, so the starting point is stored relative to the previous end point and the end point relative to the starting point
+    QByteArray data;
+    QPoint previous;
+    *count = 0;
+    for(const Diagram::Entry &entry: diagram){
+        if(entry.type != type){
+            continue;
+        }
+        const QPoint from = entry.particle->startingPoint(), to = entry.particle->endPoint();
+        appendSignedVarint(&data, from.x() - previous.x());
+        appendSignedVarint(&data, from.y() - previous.y());
+        appendSignedVarint(&data, to.x() - from.x());
+        appendSignedVarint(&data, to.y() - from.y());
+        previous = to;
+
+        //0 means no label, otherwise it's the index in the label table plus one
+        const QString labelText = entry.particle->labelText();
+        if(labelText.isEmpty()){
+            appendVarint(&data, 0);
+        }
+        else{
+            const auto it = labelIndices->constFind(labelText);
+            if(it != labelIndices->cend()){
+                appendVarint(&data, it.value() + 1);
+            }
+            else{
+                const quint32 index = quint32(labelIndices->size());
+                labelIndices->insert(labelText, index);
+                appendVarint(&data, index + 1);
+            }
+        }
+        (*count)++;
+    }
+    return data;
+}
+
+QByteArray encodeLabels(const QHash<QString, quint32> &labelIndices){
+    QList<QString> labels(labelIndices.size());
+    for(auto it = labelIndices.cbegin(); it != labelIndices.cend(); it++){
+        labels[it.value()] = it.key();
+    }
+    QByteArray data;
+    for(const QString &label: std::as_const(labels)){
+        const QByteArray utf8 = label.toUtf8();
+        appendVarint(&data, quint32(utf8.size()));
+        data.append(utf8);
+    }
+    return data;
+}
+
+bool decodeLabels(const QByteArray &data, quint32 count, QList<QString> *labels){
+    const char *position = data.constData(), *end = position + data.size();
+    labels->reserve(qMin(qsizetype(count), data.size()));
+    for(quint32 i = 0; i < count; i++){
+        quint32 size;
+        if(!readVarint(&position, end, &size) || size > quint32(end - position)){
+            return false;
+        }
+        labels->append(QString::fromUtf8(position, size));
+        position += size;
+    }
+    return true;
+}
+
+bool decodeParticles(const QByteArray &data, Particle::ParticleType type, quint32 count, const QList<QString> &labels, Diagram &diagram, const std::function<void(qsizetype)> &progress){
+    const char *position = data.constData(), *end = position + data.size();
+    QPoint previous;
+    for(quint32 i = 0; i < count; i++){
+        qint32 fromX, fromY, toX, toY;
+        quint32 label;
+        if(!readSignedVarint(&position, end, &fromX) || !readSignedVarint(&position, end, &fromY) || !readSignedVarint(&position, end, &toX) || !readSignedVarint(&position, end, &toY) || !readVarint(&position, end, &label) || label > quint32(labels.size())){
+            return false;
+        }
+        const QPoint from = previous + QPoint(fromX, fromY);
+        const QPoint to = from + QPoint(toX, toY);
+        previous = to;
+        std::unique_ptr<Particle> particle = Particle::create(type, from, to);
+        if(label != 0){
+            particle->setLabelText(labels[label - 1]);
+        }
+        diagram.insert(std::move(particle));
+        if(progress && diagram.size() % progressInterval == 0){
+            progress(diagram.size());
+        }
+    }
+    return true;
+}
+
+template<typename T>
+void readV1Particles(QDataStream &dataStream, Diagram &diagram){
+    QList<T> particles;
+    dataStream >> particles;
+    for(const T &particle: std::as_const(particles)){
+        diagram.insert(std::make_shared<const T>(particle));
+    }
+}
+
+void readV1DiagramFile(QDataStream &dataStream, Diagram &diagram){
+    readV1Particles<Fermion>(dataStream, diagram);
+    readV1Particles<Photon>(dataStream, diagram);
+    readV1Particles<WeakBoson>(dataStream, diagram);
+    readV1Particles<Gluon>(dataStream, diagram);
+    readV1Particles<Higgs>(dataStream, diagram);
+    if(!dataStream.atEnd()){
+        readV1Particles<Hadron>(dataStream, diagram);
+        readV1Particles<Vertex>(dataStream, diagram);
+    }
+    if(!dataStream.atEnd()){
+        readV1Particles<GenericBoson>(dataStream, diagram);
+    }
+}
+
+bool isV1DiagramFile(QDataStream &dataStream){
+    //Version 1 files start with the number of fermions, which is never anywhere near the magic number
+    if(dataStream.device() == nullptr){
+        return true;
+    }
+    const QByteArray start = dataStream.device()->peek(sizeof(magicNumber));
+    if(start.size() != sizeof(magicNumber)){
+        return true;
+    }
+    QDataStream startStream(start);
+    startStream.setByteOrder(dataStream.byteOrder());
+    quint32 firstWord;
+    startStream >> firstWord;
+    return firstWord != magicNumber;
+}
+
+void writeDiagramFile(QDataStream &dataStream, const Diagram &diagram){
+    TRACE_SCOPE("writeDiagramFile");
+    QList<Chunk> chunks;
+    QList<QByteArray> chunkData;
+    QHash<QString, quint32> labelIndices;
+    for(Particle::ParticleType type: particleTypes){
+        quint32 count;
+        QByteArray data = encodeParticles(diagram, type, &labelIndices, &count);
+        if(count != 0){
+            chunks.append(Chunk{quint8(type), 0, count, 0, 0});
+            chunkData.append(data);
+        }
+    }
+    //The labels are needed to decode the particles, so they're stored first
+    chunks.prepend(Chunk{labelChunk, 0, quint32(labelIndices.size()), 0, 0});
+    chunkData.prepend(encodeLabels(labelIndices));
+
+    quint32 offset = 0;
+    for(qsizetype i = 0; i < chunks.size(); i++){
+        if(chunkData[i].size() >= minimumCompressedSize){
+            const QByteArray compressed = qCompress(chunkData[i]);
+            if(compressed.size() < chunkData[i].size()){
+                chunkData[i] = compressed;
+                chunks[i].flags |= compressedChunk;
+            }
+        }
+        chunks[i].offset = offset;
+        chunks[i].size = quint32(chunkData[i].size());
+        offset += chunks[i].size;
+    }
+
+    dataStream << magicNumber << currentVersion << quint16(0) << diagram.svgRect() << quint32(chunks.size());
+    for(const Chunk &chunk: std::as_const(chunks)){
+        dataStream << chunk.kind << chunk.flags << chunk.count << chunk.offset << chunk.size;
+    }
+    for(const QByteArray &data: std::as_const(chunkData)){
+        dataStream.writeRawData(data.constData(), int(data.size()));
+    }
+}
+
+void readDiagramFile(QDataStream &dataStream, Diagram &diagram){
+    TRACE_SCOPE("readDiagramFile");
+    const DiagramFileInfo info = readDiagramFileInfo(dataStream);
+    if(dataStream.status() == QDataStream::Ok){
+        readDiagramParticles(dataStream, info, diagram);
+    }
+}
+
+qsizetype DiagramFileInfo::particleCount() const{
+    qsizetype count = 0;
+    for(quint32 particleCount: this->particleCounts){
+        count += particleCount;
+    }
+    return count;
+}
+
+DiagramFileInfo readDiagramFileInfo(QDataStream &dataStream){
+    DiagramFileInfo info;
+    if(isV1DiagramFile(dataStream)){
+        info.version = 1;
+        return info;
+    }
+
+    quint32 magic, chunkCount;
+    quint16 flags;
+    dataStream >> magic >> info.version >> flags >> info.bounds >> chunkCount;
+    if(info.version > currentVersion){
+        dataStream.setStatus(QDataStream::ReadCorruptData);
+        return info;
+    }
+    for(quint32 i = 0; i < chunkCount && dataStream.status() == QDataStream::Ok; i++){
+        Chunk chunk;
+        dataStream >> chunk.kind >> chunk.flags >> chunk.count >> chunk.offset >> chunk.size;
+        if(chunk.kind == labelChunk){
+            info.labelCount = chunk.count;
+        }
+        else if(chunk.kind < std::size(particleTypes)){
+            info.particleCounts[Particle::ParticleType(chunk.kind)] += chunk.count;
+        }
+        info.chunks.append(chunk);
+    }
+    info.dataPosition = dataStream.device()->pos();
+    return info;
+}
+
+void readDiagramParticles(QDataStream &dataStream, const DiagramFileInfo &info, Diagram &diagram, const std::function<void(qsizetype)> &progress){
+    TRACE_SCOPE("readDiagramParticles");
+    if(info.version == 1){
+        readV1DiagramFile(dataStream, diagram);
+        return;
+    }
+    diagram.reserve(diagram.size() + info.particleCount());
+
+    qint64 dataSize = 0;
+    for(const Chunk &chunk: info.chunks){
+        dataSize = qMax(dataSize, qint64(chunk.offset) + chunk.size);
+    }
+    //Sequential devices can't seek, so all the chunks are read into memory first
+    QIODevice *device = dataStream.device();
+    qint64 dataPosition = info.dataPosition;
+    QBuffer buffer;
+    if(device->isSequential()){
+        buffer.setData(device->read(dataSize));
+        buffer.open(QIODevice::ReadOnly);
+        device = &buffer;
+        dataPosition = 0;
+    }
+
+    //Each chunk is only read when it's decoded, so that the encoded data of only one chunk is in memory at a time
+    QByteArray data;
+    const auto readChunk = [&dataStream, device, dataPosition, &data](const Chunk &chunk){
+        if(!device->seek(dataPosition + chunk.offset) || chunk.size > device->bytesAvailable()){
+            dataStream.setStatus(QDataStream::ReadPastEnd);
+            return false;
+        }
+        data = device->read(chunk.size);
+        if(data.size() != qsizetype(chunk.size)){
+            dataStream.setStatus(QDataStream::ReadPastEnd);
+            return false;
+        }
+        if(chunk.flags & compressedChunk){
+            data = qUncompress(data);
+        }
+        return true;
+    };
+
+    //The label table is needed to decode the particles, so it's decoded first
+    QList<QString> labels;
+    for(const Chunk &chunk: info.chunks){
+        if(chunk.kind == labelChunk && (!readChunk(chunk) || !decodeLabels(data, chunk.count, &labels))){
+            dataStream.setStatus(QDataStream::ReadCorruptData);    //Ignored if the chunk couldn't be read, since the status is already set then
+            return;
+        }
+    }
+    for(Particle::ParticleType type: particleTypes){
+        for(const Chunk &chunk: info.chunks){
+            if(chunk.kind == type && (!readChunk(chunk) || !decodeParticles(data, type, chunk.count, labels, diagram, progress))){
+                dataStream.setStatus(QDataStream::ReadCorruptData);
+                return;
+            }
+        }
+    }
+    if(device == dataStream.device()){
+        device->seek(dataPosition + dataSize);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef DIAGRAMFILE_H
+#define DIAGRAMFILE_H
+
+#include <QDataStream>
+#include <QList>
+#include <QMap>
+#include <QRect>
+
+#include <functional>
+
+#include "diagram.hpp"
+#include "particle.hpp"
+
+//Reading and writing .fdg files.
+//Version 1 files are a bare sequence of QList<T> for each particle type. Version 2 files start with a header containing the bounds of the diagram and a table of chunks (one per particle type plus one for the labels), followed by the chunks themselves.
+//Each chunk is a list of variable length integers: coordinates are delta encoded and labels are indices into the label table. Chunks that get smaller when compressed are compressed with qCompress.
+struct DiagramFileInfo{
+    struct Chunk{
+        quint8 kind;
+        quint8 flags;
+        quint32 count;
+        quint32 offset;    //Relative to the end of the chunk table
+        quint32 size;
+    };
+
+    quint16 version = 0;
+    QRect bounds;    //Null for version 1 files, since these don't contain the bounds
+    QMap<Particle::ParticleType, quint32> particleCounts;    //Empty for version 1 files
+    quint32 labelCount = 0;
+    QList<Chunk> chunks;    //Empty for version 1 files
+    qint64 dataPosition = 0;    //Position of the end of the chunk table in the device
+
+    qsizetype particleCount() const;
+};
+
+void writeDiagramFile(QDataStream &dataStream, const Diagram &diagram);
+void readDiagramFile(QDataStream &dataStream, Diagram &diagram);
+
+//Reading a file can also be split in two steps, so that the bounds and the size of a diagram are known before any particles are decoded.
+//readDiagramFileInfo only reads the header. It leaves the stream at the first chunk for version 2 files and at the beginning of the file for version 1 files.
+//readDiagramParticles then reads each chunk by seeking to its offset. progress is called regularly with the number of particles in the diagram.
+DiagramFileInfo readDiagramFileInfo(QDataStream &dataStream);
+void readDiagramParticles(QDataStream &dataStream, const DiagramFileInfo &info, Diagram &diagram, const std::function<void(qsizetype)> &progress = nullptr);
+
+#endif // DIAGRAMFILE_H
@@ -1,22 +1,93 @@
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QKeyEvent>
 #include <QMouseEvent>
 #include <QGraphicsPathItem>
+#include <QGraphicsRectItem>
+#include <QPainter>
+#include <QPromise>
+#include <QScreen>
+#include <QScrollBar>
+#include <QStyleOptionGraphicsItem>
+#include <QWheelEvent>
+#include <QtConcurrent>
+#include <QtMath>
+#include <algorithm>
 #include "diagramviewer.hpp"
+#include "diagramfile.hpp"
+#include "layout.hpp"
+#include "trace.hpp"
 
-const int DiagramViewer::viewSize = 2000;
+const int DiagramViewer::sceneSize = 1000000;
 const int DiagramViewer::interval = 100;
+const qreal DiagramViewer::minimumZoom = 0.05;
+const qreal DiagramViewer::maximumZoom = 20;
+const qreal DiagramViewer::zoomFactor = 1.25;
+const qsizetype DiagramViewer::defaultHistoryMemoryLimit = 64 * 1024 * 1024;
 
+const int DiagramViewer::loadingBatchMilliseconds = 10;
 const int DiagramViewer::selectionSize = 3;
+const int DiagramViewer::nodeHandleSize = 8;
 const QColor DiagramViewer::selectionColor(80, 131, 193);
 
 DiagramViewer::DiagramViewer(QWidget *parent):
     QGraphicsView(new QGraphicsScene(parent), parent),
+    _topology(interval),
+    _historyPosition(0),
+    _historyMemoryUsage(0),
+    _historyMemoryLimit(defaultHistoryMemoryLimit),
+    _journal(nullptr),
+    _isLoading(false),
+    _loadingTotal(0),
+    _loadedCount(0),
+    _gridVisible(true),
+    _gridTileResolution(0),
+    _particleLayer(this->scene()->addRect(QRectF(), Qt::NoPen)),
+    _particleCaching(false),
+    _interactiveCompositing(true),
+    _isCompositing(false),
+    _isPanning(false),
     _isDrawing(false),
     _currentParticle(nullptr),
-    _currentPath(nullptr),
-    _selectedPath(nullptr)
+    _currentPath(this->scene()->addPath(QPainterPath(), Qt::NoPen, QBrush(Qt::black))),
+    _isSelecting(false),
+    _rubberBand(new QRubberBand(QRubberBand::Rectangle, this->viewport())),
+    _canDragNode(false),
+    _isDraggingNode(false)
 {
+    //The particle that's being drawn is always shown in the same item on top of the others, it's only hidden when not drawing
+    this->_currentPath->setZValue(1);
+    this->_currentPath->hide();
+    this->_particleLayer->setFlag(QGraphicsItem::ItemHasNoContents);
+    this->_currentPathTimer.setSingleShot(true);
+    this->_currentPathTimer.setTimerType(Qt::PreciseTimer);
+    connect(&this->_currentPathTimer, &QTimer::timeout, this, &DiagramViewer::updateCurrentPath);
+
+    //The progress of each of the three loading steps counts for one third of the progress bar
+    this->_loadingTimer.setSingleShot(true);
+    connect(&this->_loadingWatcher, &QFutureWatcher<std::optional<Diagram>>::progressValueChanged, this, [this](int value){
+        emit this->loadingProgress(value, int(this->_loadingTotal * 3));
+    });
+    connect(&this->_loadingWatcher, &QFutureWatcher<std::optional<Diagram>>::finished, this, &DiagramViewer::generateLoadedGeometry);
+    connect(&this->_geometryWatcher, &QFutureWatcher<void>::progressValueChanged, this, [this](int value){
+        emit this->loadingProgress(int(this->_loadingTotal + value), int(this->_loadingTotal * 3));
+    });
+    connect(&this->_geometryWatcher, &QFutureWatcher<void>::finished, this, [this](){
+        if(this->_isLoading && !this->_geometryWatcher.isCanceled()){
+            this->_loadingTimer.start(0);
+        }
+    });
+    connect(&this->_loadingTimer, &QTimer::timeout, this, &DiagramViewer::insertLoadedPaths);
+
+    //The scene is practically unbounded, and only the items in the visible part of it are drawn thanks to the scene's BSP index
+    this->scene()->setSceneRect(-sceneSize / 2, -sceneSize / 2, sceneSize, sceneSize);
+    this->setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
+    this->setViewportUpdateMode(QGraphicsView::MinimalViewportUpdate);
+    this->setOptimizationFlag(QGraphicsView::DontSavePainterState);
+    this->centerOn(0, 0);
+
     this->resetHistory();
-    this->setGridVisibiliy(true);
 }
 
 void DiagramViewer::startDrawing(Particle::ParticleType particleType){
@@ -25,363 +96,771 @@ void DiagramViewer::startDrawing(Particle::ParticleType particleType){
 }
 
 void DiagramViewer::stopDrawing(){
-    if(this->_currentPath != nullptr){
-        delete this->_currentPath;
-        this->_currentPath = nullptr;
-    }
+    this->finishDraggingNode(true);
+    this->_currentPathTimer.stop();
+    this->_currentPath->hide();
+    this->_currentPath->setPath(QPainterPath());
     this->_currentParticle = nullptr;
     this->_isDrawing = false;
+    this->updateCompositing();
     emit this->drawingStopped();
 }
 
+void DiagramViewer::selectAll(){
+    if(this->_isLoading){
+        return;
+    }
+    this->setSelectedPaths(QSet<ParticleItem*>(this->_paths.cbegin(), this->_paths.cend()));
+}
+
 void DiagramViewer::deselect(){
-    if(this->_selectedPath != nullptr){
-        redrawPath(this->_selectedPath);
-        emit this->particleDeselected();
+    this->setSelectedPaths(QSet<ParticleItem*>());
+}
+
+void DiagramViewer::setSelectedPaths(const QSet<ParticleItem*> &paths){
+    TRACE_SCOPE("DiagramViewer::setSelectedPaths");
+    //Only the paths whose selection changed are redrawn
+    for(ParticleItem *path: std::as_const(this->_selectedPaths)){
+        if(!paths.contains(path)){
+            this->redrawPath(path);
+        }
+    }
+    for(ParticleItem *path: paths){
+        if(!this->_selectedPaths.contains(path)){
+            this->redrawPath(path, selectionColor, selectionSize);
+        }
+    }
+    //An edit of the new selection must not be merged with an edit of the previous one
+    if(this->_historyPosition > 0){
+        this->_history[this->_historyPosition - 1].mergeKind = HistoryItem::NotMergeable;
+    }
+    if(paths.isEmpty() && this->_selectedPaths.isEmpty()){
+        return;
     }
-    this->_selectedPath = nullptr;
+    this->_selectedPaths = paths;
+
+    QString labelText;
+    for(auto it = paths.cbegin(); it != paths.cend(); it++){
+        const QString &particleLabelText = this->_diagram.particle(this->_particleIds.value(*it))->labelText();
+        if(it == paths.cbegin()){
+            labelText = particleLabelText;
+        }
+        else if(particleLabelText != labelText){
+            labelText.clear();
+            break;
+        }
+    }
+    emit this->selectionChanged(paths.size(), labelText);
+}
+
+QList<Diagram::ParticleId> DiagramViewer::selectedIds() const{
+    //Sorted so that bulk edits of the same selection list their changes in the same order, which allows consecutive edits to be merged
+    QList<Diagram::ParticleId> ids;
+    ids.reserve(this->_selectedPaths.size());
+    for(ParticleItem *path: this->_selectedPaths){
+        ids.append(this->_particleIds.value(path));
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
 }
 
 void DiagramViewer::clear(){
+    this->cancelLoading();
     this->stopDrawing();
     this->deselect();
+    this->clearHistory();
+    this->removeAllParticles();
+    this->compactJournal();
+}
 
-    const QList<QGraphicsPathItem*> paths = this->_particleList.fermions.keys() + this->_particleList.photons.keys() + this->_particleList.weakBosons.keys() + this->_particleList.gluons.keys() + this->_particleList.higgsBosons.keys() + this->_particleList.genericBosons.keys() + this->_particleList.hadrons.keys() + this->_particleList.vertices.keys();
-    for(QGraphicsPathItem *path: paths){
+void DiagramViewer::removeAllParticles(){
+    for(ParticleItem *path: std::as_const(this->_paths)){
         this->scene()->removeItem(path);
         delete path;
     }
-    this->_particleList.fermions.clear();
-    this->_particleList.photons.clear();
-    this->_particleList.weakBosons.clear();
-    this->_particleList.gluons.clear();
-    this->_particleList.higgsBosons.clear();
-    this->_particleList.genericBosons.clear();
-    this->_particleList.hadrons.clear();
-    this->_particleList.vertices.clear();
+    this->_paths.clear();
+    this->_particleIds.clear();
+    this->_diagram.clear();
+    this->_topology.clear();
+    this->invalidateParticleLayer();
 }
 
 void DiagramViewer::resetHistory(){
-    this->_history.clear();
-    this->_history.append(this->_particleList);
-    this->_currentHistoryItem = this->_history.end() - 1;
+    this->clearHistory();
     emit this->undoAvailable(false);
     emit this->redoAvailable(false);
 }
 
+void DiagramViewer::setHistoryMemoryLimit(qsizetype bytes){
+    this->_historyMemoryLimit = bytes;
+    while(this->_historyMemoryUsage > this->_historyMemoryLimit && this->_historyPosition > 1){
+        this->_historyMemoryUsage -= this->_history.takeFirst().memoryUsage;
+        this->_historyPosition--;
+    }
+}
+
+void DiagramViewer::setDiagram(const Diagram &diagram){
+    this->cancelLoading();
+    this->redrawAll(diagram);
+    this->resetHistory();
+}
+
+void DiagramViewer::insertDiagram(const Diagram &diagram){
+    //All the particles are added in one pass as a single edit, with their geometry generated on the thread pool beforehand like when loading a file
+    TRACE_SCOPE("DiagramViewer::insertDiagram");
+    if(this->_isLoading){
+        return;
+    }
+    this->stopDrawing();
+    this->deselect();
+    QtConcurrent::blockingMap(diagram.begin(), diagram.end(), [](const Diagram::Entry &entry){
+        entry.particle->painterPath();
+    });
+    HistoryItem item;
+    item.changes.reserve(diagram.size());
+    this->_diagram.reserve(this->_diagram.size() + diagram.size());
+    for(const Diagram::Entry &entry: diagram){
+        const Diagram::ParticleId id = this->_diagram.insert(entry.particle);
+        this->_topology.insert(id, entry.particle);
+        this->addPath(id, entry.particle);
+        item.changes.append(HistoryItem::Change{id, nullptr, entry.particle});
+    }
+    if(!item.changes.isEmpty()){
+        this->updateHistory(item);
+        emit this->diagramEdited();
+    }
+}
+
+void DiagramViewer::setJournal(Journal *journal){
+    this->_journal = journal;
+    this->compactJournal();
+}
+
+void DiagramViewer::recordChanges(const HistoryItem &item, bool reverse){
+    if(this->_journal != nullptr){
+        //The whole history item is written as one journal record, so that a bulk edit only needs one write and is never recovered halfway
+        QList<Journal::Change> changes;
+        changes.reserve(item.changes.size());
+        for(qsizetype i = 0; i < item.changes.size(); i++){
+            const HistoryItem::Change &change = item.changes[reverse ? item.changes.size() - 1 - i : i];
+            changes.append(Journal::Change{change.id, reverse ? change.before : change.after});
+        }
+        this->_journal->record(changes);
+        if(this->_journal->needsCompaction()){
+            this->compactJournal();
+        }
+    }
+}
+
+void DiagramViewer::compactJournal(){
+    if(this->_journal != nullptr){
+        this->_journal->compact(this->_diagram);
+    }
+}
+
 QDataStream &operator<<(QDataStream &dataStream, const DiagramViewer *diagramViewer){
-    dataStream << diagramViewer->_particleList.fermions.values() << diagramViewer->_particleList.photons.values() << diagramViewer->_particleList.weakBosons.values() << diagramViewer->_particleList.gluons.values() << diagramViewer->_particleList.higgsBosons.values() << diagramViewer->_particleList.hadrons.values() << diagramViewer->_particleList.vertices.values() << diagramViewer->_particleList.genericBosons.values();
+    dataStream << diagramViewer->_diagram;
     return dataStream;
 }
 
 QDataStream &operator>>(QDataStream &dataStream, DiagramViewer *diagramViewer){
-    QList<Fermion> fermions;
-    QList<Photon> photons;
-    QList<WeakBoson> weakBosons;
-    QList<Gluon> gluons;
-    QList<Higgs> higgsBosons;
-    QList<GenericBoson> genericBosons;
-    QList<Hadron> hadrons;
-    QList<Vertex> vertices;
-    dataStream >> fermions >> photons >> weakBosons >> gluons >> higgsBosons;
-    if(!dataStream.atEnd()){
-        dataStream >> hadrons >> vertices;
-    }
-    if(!dataStream.atEnd()){
-        dataStream >> genericBosons;
-    }
-    diagramViewer->redrawAll(fermions, photons, weakBosons, gluons, higgsBosons, genericBosons, hadrons, vertices);
+    Diagram diagram;
+    dataStream >> diagram;
+    diagramViewer->redrawAll(diagram);
     diagramViewer->resetHistory();
     return dataStream;
 }
 
+const Diagram &DiagramViewer::diagram() const{
+    return this->_diagram;
+}
+
+const DiagramTopology &DiagramViewer::topology() const{
+    return this->_topology;
+}
+
 QString DiagramViewer::toSvg() const{
-    int x1 = viewSize, y1 = viewSize, x2 = 0, y2 = 0;
-    const auto adjustDimensions = [&](const Particle &particle){
-        const QRect rect = particle.painterPath().boundingRect().toRect();
-        x1 = qMin(x1, rect.x());
-        y1 = qMin(y1, rect.y());
-        x2 = qMax(x2, rect.x() + rect.width());
-        y2 = qMax(y2, rect.y() + rect.height());
-    };
-    QString svgCode;
-    for(const Fermion &fermion: this->_particleList.fermions){
-        svgCode += fermion.svgCode();
-        adjustDimensions(fermion);
-    }
-    for(const Photon &photon: this->_particleList.photons){
-        svgCode += photon.svgCode();
-        adjustDimensions(photon);
-    }
-    for(const WeakBoson &weakBoson: this->_particleList.weakBosons){
-        svgCode += weakBoson.svgCode();
-        adjustDimensions(weakBoson);
-    }
-    for(const Gluon &gluon: this->_particleList.gluons){
-        svgCode += gluon.svgCode();
-        adjustDimensions(gluon);
-    }
-    for(const Higgs &higgs: this->_particleList.higgsBosons){
-        svgCode += higgs.svgCode();
-        adjustDimensions(higgs);
-    }
-    for(const GenericBoson &boson: this->_particleList.genericBosons){
-        svgCode += boson.svgCode();
-        adjustDimensions(boson);
-    }
-    for(const Hadron &hadron: this->_particleList.hadrons){
-        svgCode += hadron.svgCode();
-        adjustDimensions(hadron);
-    }
-    for(const Vertex &vertex: this->_particleList.vertices){
-        svgCode += vertex.svgCode();
-        adjustDimensions(vertex);
-    }
-    if(svgCode.isEmpty()){
-        return "";
-    }
-    x1 -= 10;
-    y1 -= 10;
-    x2 += 10;
-    y2 += 10;
-    return QString("<?xml version=\"1.0\"?><svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%1\" height=\"%2\" viewBox=\"%3 %4 %1 %2\"><rect x=\"%3\" y=\"%4\" width=\"%1\" height=\"%2\" fill=\"white\"/>%5</svg>").arg(x2 - x1).arg(y2 - y1).arg(x1).arg(y1).arg(svgCode);
+    return this->_diagram.toSvg();
 }
 
 void DiagramViewer::setGridVisibiliy(bool visible){
-    for(QGraphicsLineItem *line: std::as_const(this->_grid)){
-        this->scene()->removeItem(line);
-        delete line;
+    this->_gridVisible = visible;
+    this->resetCachedContent();
+    this->viewport()->update();
+}
+
+void DiagramViewer::setParticleCaching(bool enabled){
+    this->_particleCaching = enabled;
+    for(ParticleItem *path: std::as_const(this->_paths)){
+        path->setCacheMode(enabled ? QGraphicsItem::DeviceCoordinateCache : QGraphicsItem::NoCache);
     }
-    this->_grid.clear();
-    if(visible){
-        this->scene()->setSceneRect(0, 0, viewSize, viewSize);
-        for(int i = interval; i < viewSize; i += interval){
-            this->_grid.append(this->scene()->addLine(0, i, viewSize, i, QPen(Qt::gray)));
-            this->_grid.append(this->scene()->addLine(i, 0, i, viewSize, QPen(Qt::gray)));
-        }
+}
+
+void DiagramViewer::setInteractiveCompositing(bool enabled){
+    this->_interactiveCompositing = enabled;
+    this->updateCompositing();
+}
+
+void DiagramViewer::updateCompositing(){
+    //While drawing, panning, selecting or dragging a node, the other particles in the diagram don't change, so instead of painting each of their items every frame they're all painted once into the background, which the view caches as a single pixmap.
+    //Only the particle that's being drawn is then painted on top of it, until the cache is invalidated by a change to the diagram or the zoom level.
+    const bool compositing = this->_interactiveCompositing && (this->_isPanning || this->_currentParticle != nullptr || !this->_rubberBand->isHidden() || this->_isDraggingNode);
+    if(compositing == this->_isCompositing){
+        return;
+    }
+    TRACE_SCOPE("DiagramViewer::updateCompositing");
+    this->_isCompositing = compositing;
+    this->_particleLayer->setVisible(!compositing);
+    this->setCacheMode(compositing ? QGraphicsView::CacheBackground : QGraphicsView::CacheNone);
+    this->resetCachedContent();
+    this->viewport()->update();
+}
+
+void DiagramViewer::invalidateParticleLayer(){
+    if(this->_isCompositing){
+        this->resetCachedContent();
     }
 }
 
-void DiagramViewer::editSelectedLabel(const QString &newText){
-    if(this->_selectedPath != nullptr){
-        if(this->_particleList.fermions.contains(this->_selectedPath)){
-            this->_particleList.fermions.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        else if(this->_particleList.photons.contains(this->_selectedPath)){
-            this->_particleList.photons.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        else if(this->_particleList.weakBosons.contains(this->_selectedPath)){
-            this->_particleList.weakBosons.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        else if(this->_particleList.gluons.contains(this->_selectedPath)){
-            this->_particleList.gluons.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        else if(this->_particleList.higgsBosons.contains(this->_selectedPath)){
-            this->_particleList.higgsBosons.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        else if(this->_particleList.genericBosons.contains(this->_selectedPath)){
-            this->_particleList.genericBosons.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        else if(this->_particleList.hadrons.contains(this->_selectedPath)){
-            this->_particleList.hadrons.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        else if(this->_particleList.vertices.contains(this->_selectedPath)){
-            this->_particleList.vertices.find(this->_selectedPath).value().setLabelText(newText);
-        }
-        this->_selectedPath = this->redrawPath(this->_selectedPath, selectionColor, selectionSize);
+void DiagramViewer::zoomIn(){
+    this->setZoom(this->transform().m11() * zoomFactor);
+}
+
+void DiagramViewer::zoomOut(){
+    this->setZoom(this->transform().m11() / zoomFactor);
+}
+
+void DiagramViewer::resetZoom(){
+    this->setZoom(1);
+}
+
+void DiagramViewer::setZoom(qreal zoom){
+    zoom = qBound(minimumZoom, zoom, maximumZoom);
+    this->setTransform(QTransform::fromScale(zoom, zoom));
+    this->invalidateParticleLayer();
+}
+
+//Bulk edits of the selected particles are applied as a single history item, so they only update the scene once and are undone in one go.
+//Like all edits, they're ignored while a file is loading, since the particles are then being read by other threads and aren't all in the scene yet.
+void DiagramViewer::editSelectedLabels(const QString &newText){
+    if(this->_isLoading){
+        return;
+    }
+    HistoryItem item;
+    for(Diagram::ParticleId id: this->selectedIds()){
+        const std::shared_ptr<const Particle> before = this->_diagram.particle(id);
+        std::shared_ptr<Particle> after = before->clone();
+        after->setLabelText(newText);
+        item.changes.append(HistoryItem::Change{id, before, after});
+    }
+    item.mergeKind = HistoryItem::LabelEdit;
+    this->commitChanges(item);
+}
+
+void DiagramViewer::deleteSelectedParticles(){
+    if(this->_isLoading){
+        return;
     }
+    const QList<Diagram::ParticleId> ids = this->selectedIds();
+    this->deselect();
+    HistoryItem item;
+    for(Diagram::ParticleId id: ids){
+        item.changes.append(HistoryItem::Change{id, this->_diagram.particle(id), nullptr});
+    }
+    this->commitChanges(item);
 }
 
-void DiagramViewer::deleteSelectedParticle(){
-    if(this->_selectedPath != nullptr){
-        this->scene()->removeItem(this->_selectedPath);
-        this->_particleList.fermions.remove(this->_selectedPath);
-        this->_particleList.photons.remove(this->_selectedPath);
-        this->_particleList.weakBosons.remove(this->_selectedPath);
-        this->_particleList.gluons.remove(this->_selectedPath);
-        this->_particleList.higgsBosons.remove(this->_selectedPath);
-        this->_particleList.genericBosons.remove(this->_selectedPath);
-        this->_particleList.hadrons.remove(this->_selectedPath);
-        this->_particleList.vertices.remove(this->_selectedPath);
-        delete this->_selectedPath;
-        this->_selectedPath = nullptr;
-        this->deselect();
-        this->updateHistory();
+void DiagramViewer::moveSelectedParticles(const QPoint &offset){
+    if(this->_isLoading){
+        return;
+    }
+    HistoryItem item;
+    for(Diagram::ParticleId id: this->selectedIds()){
+        const std::shared_ptr<const Particle> before = this->_diagram.particle(id);
+        std::shared_ptr<Particle> after = before->clone();
+        after->translate(offset);
+        item.changes.append(HistoryItem::Change{id, before, after});
+    }
+    item.mergeKind = HistoryItem::Move;
+    this->commitChanges(item);
+}
+
+void DiagramViewer::autoLayout(){
+    if(this->_isLoading){
+        return;
+    }
+    this->stopDrawing();
+    const QHash<QPoint, QPoint> positions = layoutDiagram(this->_topology);
+    HistoryItem item;
+    for(const Diagram::Entry &entry: this->_diagram){
+        const QPoint node = this->_topology.snap(entry.particle->startingPoint());
+        QPoint from = positions.value(node);
+        QPoint to = positions.value(this->_topology.snap(entry.particle->endPoint()));
+        //A propagator shorter than the grid has both ends on the same node, so it moves along with the node instead of being collapsed to a single point
+        if(from == to && entry.particle->type() != Particle::Vertex && entry.particle->startingPoint() != entry.particle->endPoint()){
+            from = entry.particle->startingPoint() + positions.value(node) - node;
+            to = entry.particle->endPoint() + positions.value(node) - node;
+        }
+        if(from != entry.particle->startingPoint() || to != entry.particle->endPoint()){
+            std::shared_ptr<Particle> particle = entry.particle->clone();
+            particle->setStartingPoint(from);
+            particle->setEndPoint(to);
+            item.changes.append(HistoryItem::Change{entry.id, entry.particle, std::move(particle)});
+        }
     }
+    //Most particles usually move, so their geometry is generated on the thread pool before the scene is updated, like when loading a file
+    QtConcurrent::blockingMap(item.changes, [](HistoryItem::Change &change){
+        change.after->painterPath();
+    });
+    this->commitChanges(item);
 }
 
 void DiagramViewer::undo(){
-    if(!this->_history.isEmpty() && this->_currentHistoryItem != this->_history.begin()){
+    if(this->_historyPosition > 0 && !this->_isLoading){
         this->stopDrawing();
-        this->_currentHistoryItem--;
-        this->redrawAll(*this->_currentHistoryItem);
+        this->deselect();
+        this->_historyPosition--;
+        this->applyHistoryItem(this->_history[this->_historyPosition], true);
 
         emit this->redoAvailable(true);
-        if(this->_currentHistoryItem == this->_history.begin()){
+        if(this->_historyPosition == 0){
             emit this->undoAvailable(false);
         }
     }
 }
 
 void DiagramViewer::redo(){
-    if(!this->_history.isEmpty() && this->_currentHistoryItem != this->_history.end() - 1){
+    if(this->_historyPosition < this->_history.size() && !this->_isLoading){
         this->stopDrawing();
-        this->_currentHistoryItem++;
-        this->redrawAll(*this->_currentHistoryItem);
+        this->deselect();
+        this->applyHistoryItem(this->_history[this->_historyPosition], false);
+        this->_historyPosition++;
 
         emit this->undoAvailable(true);
-        if(this->_currentHistoryItem == this->_history.end() - 1){
+        if(this->_historyPosition == this->_history.size()){
             emit this->redoAvailable(false);
         }
     }
 }
 
+QPoint DiagramViewer::snapToGrid(const QPoint &point){
+    return (QVector2D(point) / interval).toPoint() * interval;
+}
+
 void DiagramViewer::mousePressEvent(QMouseEvent *event){
+    TRACE_SCOPE("DiagramViewer::mousePressEvent");
+    if(event->button() == Qt::MiddleButton){
+        this->_isPanning = true;
+        this->_panStartPoint = event->pos();
+        this->viewport()->setCursor(Qt::ClosedHandCursor);
+        this->updateCompositing();
+        return;
+    }
     if(this->_isDrawing){
         if(this->_currentParticle == nullptr){
-            const QPoint from = (QVector2D(event->pos()) / interval).toPoint() * interval;
-            switch(this->_currentParticleType){
-            case Particle::Fermion:
-                this->_currentParticle = std::make_unique<Fermion>(from, event->pos());
-                break;
-            case Particle::Photon:
-                this->_currentParticle = std::make_unique<Photon>(from, event->pos());
-                break;
-            case Particle::WeakBoson:
-                this->_currentParticle = std::make_unique<WeakBoson>(from, event->pos());
-                break;
-            case Particle::Gluon:
-                this->_currentParticle = std::make_unique<Gluon>(from, event->pos());
-                break;
-            case Particle::Higgs:
-                this->_currentParticle = std::make_unique<Higgs>(from, event->pos());
-                break;
-            case Particle::GenericBoson:
-                this->_currentParticle = std::make_unique<GenericBoson>(from, event->pos());
-                break;
-            case Particle::Hadron:
-                this->_currentParticle = std::make_unique<Hadron>(from, event->pos());
-                break;
-            case Particle::Vertex:
-                this->_currentParticle = std::make_unique<Vertex>(from);
-                break;
-            }
-            this->_currentPath = this->scene()->addPath(this->_currentParticle->painterPath(), Qt::NoPen, QBrush(Qt::black));
+            const QPoint position = this->mapToScene(event->pos()).toPoint();
+            this->_currentParticle = Particle::create(this->_currentParticleType, snapToGrid(position), position);
+            this->_currentPath->setPath(this->_currentParticle->painterPath());
+            this->_currentPath->show();
             if(this->_currentParticleType == Particle::Vertex){
                 this->mouseReleaseEvent(event);
             }
+            else{
+                this->updateCompositing();
+            }
         }
     }
-}
-
-template<typename T>
-constexpr void mouseReleaseEvent_helper(QMap<QGraphicsPathItem*, T> &particles, Particle *currentParticle, QGraphicsPathItem *path, QGraphicsScene *scene){
-    const T particle = *static_cast<T*>(currentParticle);
-    if(particles.key(particle, nullptr)){
-        scene->removeItem(path);
-        delete path;
-    }
-    else{
-        particles.insert(path, particle);
+    else if(event->button() == Qt::LeftButton){
+        //Pressing next to a point where particles meet can either select a particle or, once the mouse moves, start dragging that point
+        this->_isSelecting = true;
+        this->_selectionStartPoint = event->pos();
+        const QPointF position = this->mapToScene(event->pos());
+        this->_draggedNode = this->_topology.snap(position.toPoint());
+        this->_canDragNode = !event->modifiers().testAnyFlags(Qt::ControlModifier | Qt::ShiftModifier) && this->_topology.contains(this->_draggedNode) && QLineF(position, this->_draggedNode).length() * this->transform().m11() <= nodeHandleSize;
     }
 }
 
 void DiagramViewer::mouseReleaseEvent(QMouseEvent *event){
+    TRACE_SCOPE("DiagramViewer::mouseReleaseEvent");
+    if(this->_isPanning){
+        if(event->button() == Qt::MiddleButton){
+            this->_isPanning = false;
+            this->viewport()->unsetCursor();
+            this->updateCompositing();
+        }
+        return;
+    }
+    if(this->_isDraggingNode){
+        if(event->button() == Qt::LeftButton){
+            this->_currentEndPoint = this->mapToScene(event->pos()).toPoint();
+            this->updateDraggedParticles();
+            this->finishDraggingNode(false);
+        }
+        return;
+    }
     if(this->_currentParticle != nullptr){
-        const QPoint to = (QVector2D(event->pos()) / interval).toPoint() * interval;
+        const QPoint to = snapToGrid(this->mapToScene(event->pos()).toPoint());
         this->_currentParticle->setEndPoint(to);
-        this->scene()->removeItem(this->_currentPath);
-        if(this->_currentParticle->startingPoint() != to || this->_currentParticleType == Particle::Vertex){
-            QGraphicsPathItem *path = this->scene()->addPath(this->_currentParticle->painterPath(), Qt::NoPen, QBrush(Qt::black));
-            switch(this->_currentParticleType){
-            case Particle::Fermion:
-                mouseReleaseEvent_helper(this->_particleList.fermions, this->_currentParticle.get(), path, this->scene());
-                break;
-            case Particle::Photon:
-                mouseReleaseEvent_helper(this->_particleList.photons, this->_currentParticle.get(), path, this->scene());
-                break;
-            case Particle::WeakBoson:
-                mouseReleaseEvent_helper(this->_particleList.weakBosons, this->_currentParticle.get(), path, this->scene());
-                break;
-            case Particle::Gluon:
-                mouseReleaseEvent_helper(this->_particleList.gluons, this->_currentParticle.get(), path, this->scene());
-                break;
-            case Particle::Higgs:
-                mouseReleaseEvent_helper(this->_particleList.higgsBosons, this->_currentParticle.get(), path, this->scene());
-                break;
-            case Particle::GenericBoson:
-                mouseReleaseEvent_helper(this->_particleList.genericBosons, this->_currentParticle.get(), path, this->scene());
-                break;
-            case Particle::Hadron:
-                mouseReleaseEvent_helper(this->_particleList.hadrons, this->_currentParticle.get(), path, this->scene());
-                break;
-            case Particle::Vertex:
-                mouseReleaseEvent_helper(this->_particleList.vertices, this->_currentParticle.get(), path, this->scene());
-                break;
-            }
+        HistoryItem item;
+        if((this->_currentParticle->startingPoint() != to || this->_currentParticleType == Particle::Vertex) && !this->_diagram.contains(*this->_currentParticle)){
+            const std::shared_ptr<const Particle> particle = std::move(this->_currentParticle);
+            const Diagram::ParticleId id = this->_diagram.insert(particle);
+            this->_topology.insert(id, particle);
+            this->addPath(id, particle);
+            item.changes.append(HistoryItem::Change{id, nullptr, particle});
         }
         this->stopDrawing();
-        this->updateHistory();
+        if(!item.changes.isEmpty()){
+            this->updateHistory(item);
+        }
     }
-    else{
-        QGraphicsPathItem *path = dynamic_cast<QGraphicsPathItem*>(this->scene()->itemAt(event->pos(), QTransform()));
-        if(path != nullptr && path != this->_selectedPath){
-            this->deselect();
-            this->_selectedPath = this->redrawPath(path, selectionColor, selectionSize);
-            if(this->_particleList.fermions.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.fermions.find(this->_selectedPath).value());
+    else if(this->_isSelecting && event->button() == Qt::LeftButton){
+        //Holding Ctrl or Shift adds to the selection (or removes a clicked particle from it) instead of replacing it
+        this->_isSelecting = false;
+        const bool additive = event->modifiers().testAnyFlags(Qt::ControlModifier | Qt::ShiftModifier);
+        QSet<ParticleItem*> paths = additive ? this->_selectedPaths : QSet<ParticleItem*>();
+        if(!this->_rubberBand->isHidden()){
+            this->_rubberBand->hide();
+            this->updateCompositing();
+            for(QGraphicsItem *item: this->items(this->_rubberBand->geometry(), Qt::IntersectsItemShape)){
+                ParticleItem *path = dynamic_cast<ParticleItem*>(item);
+                if(this->_particleIds.contains(path)){
+                    paths.insert(path);
+                }
             }
-            else if(this->_particleList.photons.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.photons.find(this->_selectedPath).value());
-            }
-            else if(this->_particleList.weakBosons.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.weakBosons.find(this->_selectedPath).value());
+        }
+        else{
+            ParticleItem *path = dynamic_cast<ParticleItem*>(this->itemAt(event->pos()));
+            if(this->_particleIds.contains(path)){
+                if(additive && paths.contains(path)){
+                    paths.remove(path);
+                }
+                else if(additive || this->_selectedPaths != QSet<ParticleItem*>{path}){    //Clicking the only selected particle deselects it
+                    paths.insert(path);
+                }
             }
-            else if(this->_particleList.gluons.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.gluons.find(this->_selectedPath).value());
+        }
+        this->setSelectedPaths(paths);
+    }
+}
+
+void DiagramViewer::mouseMoveEvent(QMouseEvent *event){
+    TRACE_SCOPE("DiagramViewer::mouseMoveEvent");
+    if(this->_isPanning){
+        const QPoint delta = event->pos() - this->_panStartPoint;
+        this->_panStartPoint = event->pos();
+        this->horizontalScrollBar()->setValue(this->horizontalScrollBar()->value() - delta.x());
+        this->verticalScrollBar()->setValue(this->verticalScrollBar()->value() - delta.y());
+    }
+    else if(this->_isSelecting){
+        if(this->_rubberBand->isHidden() && (event->pos() - this->_selectionStartPoint).manhattanLength() >= QApplication::startDragDistance()){
+            if(this->_canDragNode){
+                this->_isSelecting = false;
+                this->startDraggingNode();
+                return;
             }
-            else if(this->_particleList.higgsBosons.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.higgsBosons.find(this->_selectedPath).value());
+            this->_rubberBand->show();
+            this->updateCompositing();
+        }
+        this->_rubberBand->setGeometry(QRect(this->_selectionStartPoint, event->pos()).normalized());
+    }
+    else if(this->_currentParticle != nullptr || this->_isDraggingNode){
+        //Mice can send mouse move events much more often than the screen refreshes, so only update the path once per frame
+        this->_currentEndPoint = this->mapToScene(event->pos()).toPoint();
+        if(!this->_currentPathTimer.isActive()){
+            this->_currentPathTimer.start(qMax(1, qFloor(1000 / this->screen()->refreshRate())));
+        }
+    }
+}
+
+void DiagramViewer::updateCurrentPath(){
+    TRACE_SCOPE("DiagramViewer::updateCurrentPath");
+    if(this->_currentParticle != nullptr){
+        this->_currentParticle->setEndPoint(this->_currentEndPoint);
+        this->_currentPath->setPath(this->_currentParticle->painterPath());
+    }
+    else if(this->_isDraggingNode){
+        this->updateDraggedParticles();
+    }
+}
+
+void DiagramViewer::startDraggingNode(){
+    //The particles attached to the node are taken out of the particle layer, so that only they are repainted while the rest of the diagram stays composited in the background
+    this->_isDraggingNode = true;
+    this->_dragTarget = this->_draggedNode;
+    this->_dragItem = HistoryItem();
+    QSet<Diagram::ParticleId> draggedIds;    //A propagator with both ends on the node is listed twice
+    for(const QList<Diagram::ParticleId> &ids: {this->_topology.edges(this->_draggedNode), this->_topology.vertices(this->_draggedNode)}){
+        for(Diagram::ParticleId id: ids){
+            if(draggedIds.contains(id)){
+                continue;
             }
-            else if(this->_particleList.genericBosons.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.genericBosons.find(this->_selectedPath).value());
+            draggedIds.insert(id);
+            const std::shared_ptr<const Particle> particle = this->_diagram.particle(id);
+            this->_dragItem.changes.append(HistoryItem::Change{id, particle, particle});
+            this->_paths.value(id)->setParentItem(nullptr);
+        }
+    }
+    this->viewport()->setCursor(Qt::SizeAllCursor);
+    this->updateCompositing();
+}
+
+void DiagramViewer::updateDraggedParticles(){
+    TRACE_SCOPE("DiagramViewer::updateDraggedParticles");
+    const QPoint target = snapToGrid(this->_currentEndPoint);
+    if(target == this->_dragTarget){
+        return;
+    }
+    //Propagators can't be shrunk to a single point, so the node can't be dropped on the other end of one of its propagators
+    QList<std::shared_ptr<Particle>> particles;
+    particles.reserve(this->_dragItem.changes.size());
+    for(const HistoryItem::Change &change: std::as_const(this->_dragItem.changes)){
+        std::shared_ptr<Particle> particle = change.before->clone();
+        const bool movesStart = this->_topology.snap(particle->startingPoint()) == this->_draggedNode;
+        const bool movesEnd = this->_topology.snap(particle->endPoint()) == this->_draggedNode;
+        //A propagator shorter than the grid has both ends on the node, so it moves along with the node instead of being collapsed to a single point
+        if(movesStart && movesEnd && particle->type() != Particle::Vertex){
+            particle->translate(target - this->_draggedNode);
+        }
+        else{
+            if(movesStart){
+                particle->setStartingPoint(target);
             }
-            else if(this->_particleList.hadrons.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.hadrons.find(this->_selectedPath).value());
+            if(movesEnd){
+                particle->setEndPoint(target);
             }
-            else if(this->_particleList.vertices.contains(this->_selectedPath)){
-                emit this->particleSelected(this->_particleList.vertices.find(this->_selectedPath).value());
+        }
+        if(particle->type() != Particle::Vertex && particle->startingPoint() == particle->endPoint()){
+            return;
+        }
+        particles.append(std::move(particle));
+    }
+    this->_dragTarget = target;
+    for(qsizetype i = 0; i < particles.size(); i++){
+        HistoryItem::Change &change = this->_dragItem.changes[i];
+        change.after = std::move(particles[i]);
+        this->_paths.value(change.id)->setParticle(change.after);
+    }
+}
+
+void DiagramViewer::finishDraggingNode(bool cancel){
+    if(!this->_isDraggingNode){
+        return;
+    }
+    this->_currentPathTimer.stop();
+    this->_isDraggingNode = false;
+    HistoryItem item;
+    for(const HistoryItem::Change &change: std::as_const(this->_dragItem.changes)){
+        ParticleItem *path = this->_paths.value(change.id);
+        path->setParentItem(this->_particleLayer);
+        if(cancel){
+            path->setParticle(change.before);
+        }
+        else if(change.after != change.before){
+            item.changes.append(change);
+        }
+    }
+    this->_dragItem = HistoryItem();
+    this->viewport()->unsetCursor();
+    this->updateCompositing();
+    //The whole drag is a single edit
+    this->commitChanges(item);
+}
+
+void DiagramViewer::wheelEvent(QWheelEvent *event){
+    if(event->modifiers() & Qt::ControlModifier){
+        this->setZoom(this->transform().m11() * qPow(zoomFactor, event->angleDelta().y() / 120.0));
+    }
+    else{
+        QGraphicsView::wheelEvent(event);
+    }
+}
+
+void DiagramViewer::keyPressEvent(QKeyEvent *event){
+    //The arrow keys move the selected particles by one grid cell, and scroll the view when nothing is selected
+    const QHash<int, QPoint> offsets = {{Qt::Key_Left, QPoint(-interval, 0)}, {Qt::Key_Right, QPoint(interval, 0)}, {Qt::Key_Up, QPoint(0, -interval)}, {Qt::Key_Down, QPoint(0, interval)}};
+    if(!this->_selectedPaths.isEmpty() && offsets.contains(event->key())){
+        this->moveSelectedParticles(offsets.value(event->key()));
+    }
+    else{
+        QGraphicsView::keyPressEvent(event);
+    }
+}
+
+void DiagramViewer::drawGrid(QPainter *painter, const QRectF &rect){
+    QGraphicsView::drawBackground(painter, rect);
+    const qreal zoom = painter->worldTransform().m11();
+    if(!this->_gridVisible || interval * zoom < 4){    //When zoomed out this far the grid would just make everything gray
+        return;
+    }
+
+    //The grid is drawn by tiling a pixmap containing one cell over the exposed area. The pixmap's resolution follows the zoom level so that the lines stay thin, and it's only recreated when that resolution changes.
+    const int resolution = qBound(1, int(qNextPowerOfTwo(quint32(qCeil(zoom) - 1))), 16);
+    if(resolution != this->_gridTileResolution){
+        this->_gridTile = QPixmap(interval * resolution, interval * resolution);
+        this->_gridTile.fill(Qt::white);
+        QPainter tilePainter(&this->_gridTile);
+        tilePainter.setPen(QPen(Qt::gray, 0));
+        tilePainter.drawLine(0, 0, this->_gridTile.width(), 0);
+        tilePainter.drawLine(0, 0, 0, this->_gridTile.height());
+        this->_gridTileResolution = resolution;
+    }
+    QBrush brush(this->_gridTile);
+    brush.setTransform(QTransform::fromScale(1.0 / resolution, 1.0 / resolution));
+    painter->fillRect(rect, brush);
+}
+
+void DiagramViewer::drawBackground(QPainter *painter, const QRectF &rect){
+    TRACE_SCOPE("DiagramViewer::drawBackground");
+    this->drawGrid(painter, rect);
+    if(this->_isCompositing){
+        //The items are hidden while compositing, so they're painted here in the same order as the scene would paint them
+        TRACE_SCOPE("DiagramViewer::drawParticleLayer");
+        QStyleOptionGraphicsItem option;
+        option.exposedRect = rect;
+        for(QGraphicsItem *item: this->_particleLayer->childItems()){
+            if(item->boundingRect().intersects(rect)){
+                item->paint(painter, &option, this->viewport());
             }
         }
-        else{
-            this->deselect();
+    }
+}
+
+void loadDiagram(QPromise<std::optional<Diagram>> &promise, const QString &fileName, const DiagramFileInfo &info){
+    TRACE_SCOPE("loadDiagram");
+    QFile file(fileName);
+    if(info.version == 0 || !file.open(QFile::ReadOnly)){
+        promise.addResult(std::nullopt);
+        return;
+    }
+    Diagram diagram;
+    QDataStream dataStream(&file);
+    promise.setProgressRange(0, int(info.particleCount()));
+    readDiagramParticles(dataStream, info, diagram, [&promise](qsizetype count){
+        promise.setProgressValue(int(count));
+    });
+    if(dataStream.status() != QDataStream::Ok){
+        promise.addResult(std::nullopt);
+        return;
+    }
+    promise.addResult(std::move(diagram));
+}
+
+void DiagramViewer::loadFile(const QString &fileName){
+    //Loading happens in three steps so that the GUI never freezes: the file is decoded on a worker thread, then the geometry of the particles is generated on the thread pool, then the particles are added to the scene a few at a time
+    this->clear();
+    this->resetHistory();
+    this->setEnabled(false);
+    this->_isLoading = true;
+
+    //Only the header is read right away. It says where the diagram is and how many particles it has (except in version 1 files), so the view can be centered on the diagram and the progress can be shown while the particles are decoded.
+    DiagramFileInfo info;
+    QFile file(fileName);
+    if(file.open(QFile::ReadOnly)){
+        QDataStream dataStream(&file);
+        info = readDiagramFileInfo(dataStream);
+        if(dataStream.status() != QDataStream::Ok){
+            info = DiagramFileInfo();
         }
     }
+    if(!info.bounds.isNull()){
+        this->centerOn(info.bounds.center());
+    }
+    this->_loadingTotal = info.particleCount();
+    emit this->loadingProgress(0, int(this->_loadingTotal * 3));
+    this->_loadingWatcher.setFuture(QtConcurrent::run(loadDiagram, fileName, info));
 }
 
-void DiagramViewer::mouseMoveEvent(QMouseEvent *event){
-    if(this->_currentParticle != nullptr){
-        this->_currentParticle->setEndPoint(event->pos());
-        this->scene()->removeItem(this->_currentPath);
-        delete this->_currentPath;
-        this->_currentPath = this->scene()->addPath(this->_currentParticle->painterPath(), Qt::NoPen, QBrush(Qt::black));
+bool DiagramViewer::isLoading() const{
+    return this->_isLoading;
+}
+
+void DiagramViewer::cancelLoading(){
+    if(this->_isLoading){
+        this->_isLoading = false;
+        //The particles whose geometry is being generated are owned by the diagram, so they can't be deleted until the threads that are using them are done
+        this->_geometryWatcher.cancel();
+        this->_geometryWatcher.waitForFinished();
+        this->_loadingTimer.stop();
+        //Only some of the loaded particles have been added to the scene, so the loaded diagram is discarded to keep the diagram and the scene consistent. The diagram was empty before loading started.
+        this->removeAllParticles();
+        this->setEnabled(true);
+        emit this->loadingCanceled();
+    }
+}
+
+void DiagramViewer::generateLoadedGeometry(){
+    if(!this->_isLoading || this->_loadingWatcher.isCanceled()){
+        return;
+    }
+    std::optional<Diagram> diagram = this->_loadingWatcher.result();
+    if(!diagram.has_value()){
+        this->cancelLoading();
+        emit this->loadingFinished(false);
+        return;
+    }
+    //Particles are never modified once they're in a diagram, but their geometry is generated lazily, so it can be generated on other threads as long as each particle is only accessed by one thread
+    this->_diagram = std::move(*diagram);
+    this->_topology.rebuild(this->_diagram);
+    this->_loadingTotal = this->_diagram.size();
+    this->_loadedCount = 0;
+    emit this->loadingProgress(int(this->_loadingTotal), int(this->_loadingTotal * 3));
+    this->_geometryWatcher.setFuture(QtConcurrent::map(this->_diagram.begin(), this->_diagram.end(), [](const Diagram::Entry &entry){
+        entry.particle->painterPath();
+    }));
+}
+
+void DiagramViewer::insertLoadedPaths(){
+    TRACE_SCOPE("DiagramViewer::insertLoadedPaths");
+    if(!this->_isLoading){
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const auto begin = this->_diagram.begin();
+    while(this->_loadedCount < this->_diagram.size() && !timer.hasExpired(loadingBatchMilliseconds)){
+        const Diagram::Entry &entry = *(begin + this->_loadedCount);
+        this->addPath(entry.id, entry.particle);
+        this->_loadedCount++;
+    }
+    if(this->_loadedCount < this->_diagram.size()){
+        //Receivers may process events when they're told about the progress, so the timer must only be restarted afterwards
+        emit this->loadingProgress(int(this->_loadingTotal * 2 + this->_loadedCount), int(this->_loadingTotal * 3));
+        if(this->_isLoading){
+            this->_loadingTimer.start(0);
+        }
+    }
+    else{
+        this->_isLoading = false;
+        this->setEnabled(true);
+        this->compactJournal();
+        emit this->loadingFinished(true);
     }
 }
 
-template<typename T>
-constexpr QGraphicsPathItem *redrawPath_helper(QMap<QGraphicsPathItem*, T> &particles, QGraphicsPathItem *path, const QColor &color, const QPen &pen, QGraphicsScene *scene){
-    if(particles.contains(path)){
-        const T particle = particles.find(path).value();
-        QGraphicsPathItem *newPath = scene->addPath(particle.painterPath(), pen, QBrush(color));
-        particles.insert(newPath, particle);
-        particles.remove(path);
+ParticleItem *DiagramViewer::addPath(Diagram::ParticleId id, std::shared_ptr<const Particle> particle){
+    ParticleItem *path = new ParticleItem(std::move(particle));
+    path->setCacheMode(this->_particleCaching ? QGraphicsItem::DeviceCoordinateCache : QGraphicsItem::NoCache);
+    path->setParentItem(this->_particleLayer);
+    this->invalidateParticleLayer();
+    this->_paths.insert(id, path);
+    this->_particleIds.insert(path, id);
+    return path;
+}
+
+void DiagramViewer::removePath(Diagram::ParticleId id){
+    ParticleItem *path = this->_paths.take(id);
+    if(path != nullptr){
+        this->_particleIds.remove(path);
+        this->_selectedPaths.remove(path);
+        this->scene()->removeItem(path);
         delete path;
-        return newPath;
+        this->invalidateParticleLayer();
     }
-    return nullptr;
 }
 
-QGraphicsPathItem *DiagramViewer::redrawPath(QGraphicsPathItem *path, const QColor &color, int strokeWidth){
+void DiagramViewer::redrawPath(ParticleItem *path, const QColor &color, int strokeWidth){
+    TRACE_SCOPE("DiagramViewer::redrawPath");
     QPen pen;
     if(strokeWidth == 0){
         pen = Qt::NoPen;
@@ -390,66 +869,140 @@ QGraphicsPathItem *DiagramViewer::redrawPath(QGraphicsPathItem *path, const QCol
         pen.setWidth(strokeWidth);
         pen.setColor(color);
     }
-    QGraphicsPathItem *toReturn = nullptr;
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.fermions, path, color, pen, this->scene());
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.photons, path, color, pen, this->scene());
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.weakBosons, path, color, pen, this->scene());
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.gluons, path, color, pen, this->scene());
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.higgsBosons, path, color, pen, this->scene());
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.genericBosons, path, color, pen, this->scene());
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.hadrons, path, color, pen, this->scene());
-    if(!toReturn) toReturn = redrawPath_helper(this->_particleList.vertices, path, color, pen, this->scene());
-    this->updateHistory();
-    return toReturn;
+    path->setPen(pen);
+    path->setBrush(QBrush(color));
+    this->invalidateParticleLayer();
 }
 
-void DiagramViewer::redrawAll(const QList<Fermion> &fermions, const QList<Photon> &photons, const QList<WeakBoson> &weakBosons, const QList<Gluon> &gluons, const QList<Higgs> &higgsBosons, const QList<GenericBoson> &genericBosons, const QList<Hadron> &hadrons, const QList<Vertex> &vertices){
-    this->clear();
-    for(const Fermion &fermion: fermions){
-        QGraphicsPathItem *path = this->scene()->addPath(fermion.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.fermions.insert(path, fermion);
-    }
-    for(const Photon &photon: photons){
-        QGraphicsPathItem *path = this->scene()->addPath(photon.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.photons.insert(path, photon);
-    }
-    for(const WeakBoson &weakBoson: weakBosons){
-        QGraphicsPathItem *path = this->scene()->addPath(weakBoson.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.weakBosons.insert(path, weakBoson);
+struct ParticleKey{
+    Particle::ParticleType type;
+    QPoint from, to;
+    QString labelText;
+
+    ParticleKey(const Particle &particle): type(particle.type()), from(particle.startingPoint()), to(particle.endPoint()), labelText(particle.labelText()){}
+
+    bool operator==(const ParticleKey &other) const{
+        return this->type == other.type && this->from == other.from && this->to == other.to && this->labelText == other.labelText;
     }
-    for(const Gluon &gluon: gluons){
-        QGraphicsPathItem *path = this->scene()->addPath(gluon.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.gluons.insert(path, gluon);
+};
+
+size_t qHash(const ParticleKey &key, size_t seed = 0){
+    return qHashMulti(seed, key.type, key.from.x(), key.from.y(), key.to.x(), key.to.y(), key.labelText);
+}
+
+void DiagramViewer::redrawAll(const Diagram &diagram){
+    TRACE_SCOPE("DiagramViewer::redrawAll");
+    this->stopDrawing();
+    this->deselect();
+    this->clearHistory();
+
+    //Reuse the paths of the particles that are already on screen, so that only the particles that differ need to be added or removed. A reused path keeps showing the old particle, which has the same geometry as the new one.
+    QMultiHash<ParticleKey, ParticleItem*> unusedPaths;
+    for(const Diagram::Entry &entry: this->_diagram){
+        unusedPaths.insert(ParticleKey(*entry.particle), this->_paths.value(entry.id));
+    }
+    this->_paths.clear();
+    this->_particleIds.clear();
+    this->_diagram = diagram;
+    this->_topology.rebuild(this->_diagram);
+    for(const Diagram::Entry &entry: this->_diagram){
+        const auto it = unusedPaths.find(ParticleKey(*entry.particle));
+        if(it == unusedPaths.end()){
+            this->addPath(entry.id, entry.particle);
+        }
+        else{
+            this->_paths.insert(entry.id, it.value());
+            this->_particleIds.insert(it.value(), entry.id);
+            unusedPaths.erase(it);
+        }
     }
-    for(const Higgs &higgs: higgsBosons){
-        QGraphicsPathItem *path = this->scene()->addPath(higgs.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.higgsBosons.insert(path, higgs);
+    for(ParticleItem *path: std::as_const(unusedPaths)){
+        this->scene()->removeItem(path);
+        delete path;
     }
-    for(const GenericBoson &boson: genericBosons){
-        QGraphicsPathItem *path = this->scene()->addPath(boson.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.genericBosons.insert(path, boson);
+    this->invalidateParticleLayer();
+    this->compactJournal();
+}
+
+void DiagramViewer::updateHistory(HistoryItem item){
+    TRACE_SCOPE("DiagramViewer::updateHistory");
+    while(this->_history.size() > this->_historyPosition){
+        this->_historyMemoryUsage -= this->_history.takeLast().memoryUsage;
     }
-    for(const Hadron &hadron: hadrons){
-        QGraphicsPathItem *path = this->scene()->addPath(hadron.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.hadrons.insert(path, hadron);
+
+    const auto sameParticle = [](const HistoryItem::Change &a, const HistoryItem::Change &b){
+        return a.id == b.id;
+    };
+    if(item.mergeKind != HistoryItem::NotMergeable && this->_historyPosition > 0 && this->_history.last().mergeKind == item.mergeKind && std::equal(item.changes.cbegin(), item.changes.cend(), this->_history.last().changes.cbegin(), this->_history.last().changes.cend(), sameParticle)){
+        //Consecutive edits of the same particles (for example typing a label one character at a time) are undone in one go
+        for(qsizetype i = 0; i < item.changes.size(); i++){
+            item.changes[i].before = this->_history.last().changes[i].before;
+        }
+        this->_historyMemoryUsage -= this->_history.takeLast().memoryUsage;
+        this->_historyPosition--;
     }
-    for(const Vertex &vertex: vertices){
-        QGraphicsPathItem *path = this->scene()->addPath(vertex.painterPath(), Qt::NoPen, QBrush(Qt::black));
-        this->_particleList.vertices.insert(path, vertex);
+
+    item.memoryUsage = sizeof(HistoryItem);
+    for(const HistoryItem::Change &change: std::as_const(item.changes)){
+        item.memoryUsage += sizeof(HistoryItem::Change);
+        for(const Particle *particle: {change.before.get(), change.after.get()}){
+            if(particle != nullptr){
+                item.memoryUsage += particle->memoryUsage();
+            }
+        }
     }
+    this->recordChanges(item, false);
+    this->_historyMemoryUsage += item.memoryUsage;
+    this->_history.append(item);
+    this->_historyPosition++;
+
+    //Forget the oldest edits when the history gets too big, but always keep the latest one so that it can be undone
+    this->setHistoryMemoryLimit(this->_historyMemoryLimit);
+
+    emit this->undoAvailable(true);
+    emit this->redoAvailable(false);
 }
 
-void DiagramViewer::redrawAll(const ParticleList &particleList){
-    this->redrawAll(particleList.fermions.values(), particleList.photons.values(), particleList.weakBosons.values(), particleList.gluons.values(), particleList.higgsBosons.values(), particleList.genericBosons.values(), particleList.hadrons.values(), particleList.vertices.values());
+void DiagramViewer::applyHistoryItem(const HistoryItem &item, bool reverse){
+    TRACE_SCOPE("DiagramViewer::applyHistoryItem");
+    this->applyChanges(item, reverse);
+    this->recordChanges(item, reverse);
 }
 
-void DiagramViewer::updateHistory(){
-    if(!this->_history.isEmpty()){
-        this->_history.erase(this->_currentHistoryItem + 1, this->_history.end());
+void DiagramViewer::commitChanges(const HistoryItem &item){
+    TRACE_SCOPE("DiagramViewer::commitChanges");
+    if(!item.changes.isEmpty()){
+        this->applyChanges(item, false);
+        this->updateHistory(item);
+        emit this->diagramEdited();
     }
-    this->_history.append(this->_particleList);
-    this->_currentHistoryItem = this->_history.end() - 1;
+}
 
-    emit this->undoAvailable(true);
-    emit this->redoAvailable(false);
+void DiagramViewer::applyChanges(const HistoryItem &item, bool reverse){
+    for(qsizetype i = 0; i < item.changes.size(); i++){
+        const HistoryItem::Change &change = item.changes[reverse ? item.changes.size() - 1 - i : i];
+        const std::shared_ptr<const Particle> &particle = reverse ? change.before : change.after;
+        if(particle == nullptr){
+            this->removePath(change.id);
+            this->_diagram.remove(change.id);
+            this->_topology.remove(change.id);
+        }
+        else if(this->_diagram.contains(change.id)){
+            this->_diagram.replace(change.id, particle);
+            this->_topology.insert(change.id, particle);
+            this->_paths.value(change.id)->setParticle(particle);
+            this->invalidateParticleLayer();
+        }
+        else{
+            this->_diagram.insert(change.id, particle);
+            this->_topology.insert(change.id, particle);
+            this->addPath(change.id, particle);
+        }
+    }
+}
+
+void DiagramViewer::clearHistory(){
+    this->_history.clear();
+    this->_historyPosition = 0;
+    this->_historyMemoryUsage = 0;
 }
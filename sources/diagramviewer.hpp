@@ -1,12 +1,22 @@
 #ifndef DIAGRAMVIEWER_H
 #define DIAGRAMVIEWER_H
 
+#include <QFutureWatcher>
 #include <QGraphicsView>
-#include <QMap>
+#include <QHash>
+#include <QPixmap>
+#include <QRubberBand>
+#include <QSet>
+#include <QTimer>
 
 #include <memory>
+#include <optional>
 
+#include "diagram.hpp"
+#include "journal.hpp"
 #include "particle.hpp"
+#include "particleitem.hpp"
+#include "topology.hpp"
 
 class DiagramViewer : public QGraphicsView {
     Q_OBJECT
@@ -19,68 +29,155 @@ public:
 
     void clear();
     void resetHistory();
+    void setHistoryMemoryLimit(qsizetype bytes);
+
+    void loadFile(const QString &fileName);
+    void setDiagram(const Diagram &diagram);
+    void insertDiagram(const Diagram &diagram);
+    void setJournal(Journal *journal);
+    bool isLoading() const;
 
     friend QDataStream &operator<<(QDataStream &dataStream, const DiagramViewer *diagramViewer);
     friend QDataStream &operator>>(QDataStream &dataStream, DiagramViewer *diagramViewer);
+    const Diagram &diagram() const;
+    const DiagramTopology &topology() const;
     QString toSvg() const;
 
 public slots:
     void setGridVisibiliy(bool visible);
+    void setParticleCaching(bool enabled);
+    void setInteractiveCompositing(bool enabled);
+
+    void cancelLoading();
+
+    void zoomIn();
+    void zoomOut();
+    void resetZoom();
 
-    void editSelectedLabel(const QString &newText);
-    void deleteSelectedParticle();
+    void editSelectedLabels(const QString &newText);
+    void deleteSelectedParticles();
+    void moveSelectedParticles(const QPoint &offset);
 
+    void selectAll();
     void deselect();
 
+    void autoLayout();
+
     void undo();
     void redo();
 
 signals:
     void drawingStopped();
 
-    void particleSelected(const Particle &particle);
-    void particleDeselected();
+    void selectionChanged(qsizetype count, const QString &labelText);    //labelText is the label of all the selected particles if they have the same one, and empty otherwise
+    void diagramEdited();
 
     void undoAvailable(bool available);
     void redoAvailable(bool available);
 
+    void loadingProgress(int value, int maximum);
+    void loadingFinished(bool ok);
+    void loadingCanceled();
+
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void drawBackground(QPainter *painter, const QRectF &rect) override;
 
 private:
-    struct ParticleList{
-        QMap<QGraphicsPathItem*, Fermion> fermions;
-        QMap<QGraphicsPathItem*, Photon> photons;
-        QMap<QGraphicsPathItem*, WeakBoson> weakBosons;
-        QMap<QGraphicsPathItem*, Gluon> gluons;
-        QMap<QGraphicsPathItem*, Higgs> higgsBosons;
-        QMap<QGraphicsPathItem*, GenericBoson> genericBosons;
-        QMap<QGraphicsPathItem*, Hadron> hadrons;
-        QMap<QGraphicsPathItem*, Vertex> vertices;
+    //An edit that can be undone. Only the particles that changed are stored, before is null for inserted particles and after is null for removed particles.
+    struct HistoryItem{
+        struct Change{
+            Diagram::ParticleId id;
+            std::shared_ptr<const Particle> before;
+            std::shared_ptr<const Particle> after;
+        };
+
+        QList<Change> changes;
+        qsizetype memoryUsage = 0;
+        enum MergeKind{NotMergeable, LabelEdit, Move} mergeKind = NotMergeable;
     };
 
-    QGraphicsPathItem *redrawPath(QGraphicsPathItem *path, const QColor &color = Qt::black, int strokeWidth = 0);
-    void redrawAll(const QList<Fermion> &fermions, const QList<Photon> &photons, const QList<WeakBoson> &weakBosons, const QList<Gluon> &gluons, const QList<Higgs> &higgsBosons, const QList<GenericBoson> &genericBosons, const QList<Hadron> &hadrons, const QList<Vertex> &vertices);
-    void redrawAll(const ParticleList &particleList);
-    void updateHistory();
-
-    ParticleList _particleList;
-
-    QList<ParticleList> _history;
-    QList<ParticleList>::iterator _currentHistoryItem;
-
-    QList<QGraphicsLineItem*> _grid;
+    static QPoint snapToGrid(const QPoint &point);
+    void setZoom(qreal zoom);
+    void drawGrid(QPainter *painter, const QRectF &rect);
+
+    ParticleItem *addPath(Diagram::ParticleId id, std::shared_ptr<const Particle> particle);
+    void removePath(Diagram::ParticleId id);
+    void removeAllParticles();
+    void updateCompositing();
+    void invalidateParticleLayer();
+    void redrawPath(ParticleItem *path, const QColor &color = Qt::black, int strokeWidth = 0);
+    void updateCurrentPath();
+    void setSelectedPaths(const QSet<ParticleItem*> &paths);
+    void startDraggingNode();
+    void updateDraggedParticles();
+    void finishDraggingNode(bool cancel);
+    QList<Diagram::ParticleId> selectedIds() const;
+    void redrawAll(const Diagram &diagram);
+    void generateLoadedGeometry();
+    void insertLoadedPaths();
+    void updateHistory(HistoryItem item);
+    void applyHistoryItem(const HistoryItem &item, bool reverse);
+    void applyChanges(const HistoryItem &item, bool reverse);
+    void commitChanges(const HistoryItem &item);
+    void clearHistory();
+    void recordChanges(const HistoryItem &item, bool reverse);
+    void compactJournal();
+
+    Diagram _diagram;
+    DiagramTopology _topology;
+    QHash<Diagram::ParticleId, ParticleItem*> _paths;
+    QHash<ParticleItem*, Diagram::ParticleId> _particleIds;
+
+    QList<HistoryItem> _history;
+    qsizetype _historyPosition;    //Number of history items that are currently applied
+    qsizetype _historyMemoryUsage, _historyMemoryLimit;
+    Journal *_journal;
+
+    bool _isLoading;
+    QFutureWatcher<std::optional<Diagram>> _loadingWatcher;
+    QFutureWatcher<void> _geometryWatcher;
+    QTimer _loadingTimer;
+    qsizetype _loadingTotal;    //Number of particles in the file that's being loaded, or 0 if it's not known yet
+    qsizetype _loadedCount;
+
+    bool _gridVisible;
+    QPixmap _gridTile;
+    int _gridTileResolution;
+
+    QGraphicsRectItem *_particleLayer;    //Parent of the items of all the particles in the diagram
+    bool _particleCaching;
+    bool _interactiveCompositing, _isCompositing;
+
+    bool _isPanning;
+    QPoint _panStartPoint;
 
     bool _isDrawing;
     Particle::ParticleType _currentParticleType;
     std::unique_ptr<Particle> _currentParticle;
     QGraphicsPathItem *_currentPath;
-    QGraphicsPathItem *_selectedPath;
-
-    static const int viewSize, interval;
+    QTimer _currentPathTimer;
+    QPoint _currentEndPoint;
+    QSet<ParticleItem*> _selectedPaths;
+
+    bool _isSelecting;
+    QPoint _selectionStartPoint;
+    QRubberBand *_rubberBand;
+
+    bool _canDragNode, _isDraggingNode;
+    QPoint _draggedNode, _dragTarget;
+    HistoryItem _dragItem;    //The particles attached to the dragged node, before and after moving it
+
+    static const int sceneSize, interval;
+    static const qreal minimumZoom, maximumZoom, zoomFactor;
+    static const qsizetype defaultHistoryMemoryLimit;
+    static const int loadingBatchMilliseconds;
     static const int selectionSize;
+    static const int nodeHandleSize;
     static const QColor selectionColor;
 };
 
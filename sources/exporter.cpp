@@ -0,0 +1,154 @@
+#include "exporter.hpp"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QScreen>
+#include <QTextStream>
+#include <QtConcurrent>
+
+#include "diagram.hpp"
+#include "textimporter.hpp"
+#include "trace.hpp"
+
+bool exportDiagram(const Diagram &diagram, const QString &fileName, ExportFormat format, qreal dotsPerInch){
+    TRACE_SCOPE("exportDiagram");
+    if(format == ExportFormat::Svg){
+        QFile file(fileName);
+        return file.open(QFile::WriteOnly | QFile::Text) && diagram.writeSvg(&file);
+    }
+    if(format == ExportFormat::Fdg){
+        QFile file(fileName);
+        if(!file.open(QFile::WriteOnly)){
+            return false;
+        }
+        QDataStream dataStream(&file);
+        dataStream << diagram;
+        return dataStream.status() == QDataStream::Ok;
+    }
+    const QSize size = diagram.svgRect().size();
+    if(format == ExportFormat::Png){
+        QImage image(size, QImage::Format_ARGB32);
+        QPainter painter(&image);
+        const bool ok = diagram.render(&painter);
+        painter.end();
+        return ok && image.save(fileName, "png");
+    }
+    else{
+        QPdfWriter pdfWriter(fileName);
+        pdfWriter.setPageSize(QPageSize(size * 72 / dotsPerInch));
+        QPainter painter(&pdfWriter);
+        const bool ok = diagram.render(&painter);
+        return painter.end() && ok;
+    }
+}
+
+int runBatchExport(const QStringList &arguments){
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("export", QObject::tr("Export the given files to <directory> without opening any windows."), QObject::tr("directory")));
+    parser.addOption(QCommandLineOption("format", QObject::tr("Comma-separated list of formats to export to (svg, png, pdf or fdg)."), QObject::tr("formats"), "svg"));
+    parser.addPositionalArgument("files", QObject::tr("The FDG files, or FDT files describing diagrams as text, to export."), "[files...]");
+    parser.process(arguments);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QList<ExportFormat> formats;
+    QStringList extensions;
+    for(const QString &format: parser.value("format").toLower().split(',', Qt::SkipEmptyParts)){
+        if(extensions.contains(format)){
+            continue;
+        }
+        if(format == "svg") formats.append(ExportFormat::Svg);
+        else if(format == "png") formats.append(ExportFormat::Png);
+        else if(format == "pdf") formats.append(ExportFormat::Pdf);
+        else if(format == "fdg") formats.append(ExportFormat::Fdg);
+        else{
+            err << QObject::tr("Unknown export format: %1").arg(format) << Qt::endl;
+            return 1;
+        }
+        extensions.append(format);
+    }
+
+    const QDir outputDirectory(parser.value("export"));
+    if(!outputDirectory.mkpath(".")){
+        err << QObject::tr("Could not create the directory %1.").arg(outputDirectory.path()) << Qt::endl;
+        return 1;
+    }
+
+    //QScreen may only be used from the GUI thread, so this needs to be read before starting the worker threads
+    const qreal dotsPerInch = QGuiApplication::primaryScreen()->physicalDotsPerInch();
+
+    //The output files are named after the input files, so two input files with the same base name (in different directories or with different extensions) would overwrite each other's output while being exported at the same time
+    const QStringList fileNames = parser.positionalArguments();
+    const auto outputBaseName = [&outputDirectory](const QString &fileName){
+        return outputDirectory.filePath(QFileInfo(fileName).completeBaseName());
+    };
+    QHash<QString, QString> inputFiles;    //Keys are the lower case output base names, since file names aren't case sensitive on all platforms
+    for(const QString &fileName: fileNames){
+        const QString baseName = outputBaseName(fileName);
+        const auto it = inputFiles.constFind(baseName.toLower());
+        if(it != inputFiles.cend()){
+            err << QObject::tr("The files %1 and %2 would both be exported to %3. Please export them to different directories.").arg(it.value(), fileName, baseName + ".*") << Qt::endl;
+            return 1;
+        }
+        inputFiles.insert(baseName.toLower(), fileName);
+    }
+
+    //Each file is reported as soon as it's exported so that the progress can be followed, while the errors are all reported at the end
+    QMutex outMutex;
+    const QList<QString> errors = QtConcurrent::blockingMapped(fileNames, [&](const QString &fileName){
+        QElapsedTimer timer;
+        timer.start();
+        QString error;
+        Diagram diagram;
+        if(QFileInfo(fileName).suffix().compare("fdt", Qt::CaseInsensitive) == 0){
+            std::optional<Diagram> importedDiagram = importDiagramTextFile(fileName, &error);
+            if(!importedDiagram.has_value()){
+                return error;
+            }
+            diagram = std::move(*importedDiagram);
+        }
+        else{
+            QFile file(fileName);
+            if(!file.open(QFile::ReadOnly)){
+                return QObject::tr("Could not open the file %1. You might not have sufficient permissions to read at this location.").arg(fileName);
+            }
+            QDataStream dataStream(&file);
+            dataStream >> diagram;
+            if(dataStream.status() != QDataStream::Ok){
+                return QObject::tr("The file %1 is not a valid Feynman diagram file.").arg(fileName);
+            }
+        }
+        if(diagram.svgRect().isNull()){
+            return QObject::tr("The diagram %1 is empty.").arg(fileName);
+        }
+        for(qsizetype i = 0; i < formats.size(); i++){
+            const QString outputFile = outputBaseName(fileName) + "." + extensions[i];
+            if(!exportDiagram(diagram, outputFile, formats[i], dotsPerInch)){
+                return QObject::tr("Could not save the file %1. You might not have sufficient permissions to write at this location.").arg(outputFile);
+            }
+        }
+        const QMutexLocker locker(&outMutex);
+        out << fileName << ": " << timer.elapsed() << " ms" << Qt::endl;
+        return QString();
+    });
+
+    int exitCode = 0;
+    for(const QString &error: errors){
+        if(!error.isEmpty()){
+            err << error << Qt::endl;
+            exitCode = 1;
+        }
+    }
+    return exitCode;
+}
@@ -0,0 +1,14 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <QString>
+#include <QStringList>
+
+#include "diagram.hpp"
+
+enum class ExportFormat{Svg, Png, Pdf, Fdg};
+
+bool exportDiagram(const Diagram &diagram, const QString &fileName, ExportFormat format, qreal dotsPerInch);
+int runBatchExport(const QStringList &arguments);
+
+#endif // EXPORTER_H
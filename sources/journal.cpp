@@ -0,0 +1,281 @@
+#include "journal.hpp"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "trace.hpp"
+
+const quint32 Journal::magicNumber = 0x46444A4C;    //"FDJL"
+const quint16 Journal::version = 2;
+const qsizetype Journal::minimumCompactionRecords = 1000;
+const int Journal::maximumInstances = 100;
+
+//Each record is stored as its size, its contents and a checksum, so that a record that was only partially written when the program crashed can be detected.
+//A batch record contains all the particle and removed records of one edit, so that an edit is either recovered completely or not at all.
+enum RecordType: quint8{ParticleRecord = 'P', RemovedRecord = 'R', BatchRecord = 'B', DocumentRecord = 'D'};
+
+void appendRecord(QByteArray *records, const QByteArray &payload){
+    QDataStream dataStream(records, QIODevice::WriteOnly | QIODevice::Append);
+    dataStream << quint32(payload.size());
+    dataStream.writeRawData(payload.constData(), int(payload.size()));
+    dataStream << qChecksum(payload);
+}
+
+void writeChange(QDataStream &dataStream, Diagram::ParticleId id, const std::shared_ptr<const Particle> &particle){
+    if(particle == nullptr){
+        dataStream << quint8(RemovedRecord) << id;
+    }
+    else{
+        dataStream << quint8(ParticleRecord) << id << quint8(particle->type()) << particle->startingPoint() << particle->endPoint() << particle->labelText();
+    }
+}
+
+bool readChange(QDataStream &dataStream, Journal::Change *change){
+    quint8 recordType;
+    dataStream >> recordType >> change->id;
+    if(recordType == RemovedRecord){
+        change->particle = nullptr;
+        return dataStream.status() == QDataStream::Ok;
+    }
+    quint8 particleType;
+    QPoint from, to;
+    QString labelText;
+    dataStream >> particleType >> from >> to >> labelText;
+    if(recordType != ParticleRecord || dataStream.status() != QDataStream::Ok || particleType > Particle::Vertex){
+        return false;
+    }
+    std::unique_ptr<Particle> particle = Particle::create(Particle::ParticleType(particleType), from, to);
+    particle->setLabelText(labelText);
+    change->particle = std::move(particle);
+    return true;
+}
+
+void appendParticleRecord(QByteArray *records, Diagram::ParticleId id, const std::shared_ptr<const Particle> &particle){
+    QByteArray payload;
+    QDataStream dataStream(&payload, QIODevice::WriteOnly);
+    writeChange(dataStream, id, particle);
+    appendRecord(records, payload);
+}
+
+void appendBatchRecord(QByteArray *records, const QList<Journal::Change> &changes){
+    QByteArray payload;
+    QDataStream dataStream(&payload, QIODevice::WriteOnly);
+    dataStream << quint8(BatchRecord) << quint32(changes.size());
+    for(const Journal::Change &change: changes){
+        writeChange(dataStream, change.id, change.particle);
+    }
+    appendRecord(records, payload);
+}
+
+void appendDocumentRecord(QByteArray *records, const QString &documentName, bool isClean){
+    QByteArray payload;
+    QDataStream dataStream(&payload, QIODevice::WriteOnly);
+    dataStream << quint8(DocumentRecord) << documentName << isClean;
+    appendRecord(records, payload);
+}
+
+Journal::Journal():
+    _isClean(true),
+    _snapshotSize(0),
+    _recordsSinceCompaction(0)
+{
+    this->_writer.setMaxThreadCount(1);
+
+    const QDir directory(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/autosave");
+    if(!directory.mkpath(".")){
+        return;
+    }
+    //A journal whose lock can be acquired belongs to an instance that crashed, this instance takes the first free slot without a journal
+    for(int i = 0; i < maximumInstances; i++){
+        const QString fileName = directory.filePath(QString("journal%1.fdj").arg(i));
+        const bool isOrphan = QFile::exists(fileName);
+        if(!isOrphan && this->_lockFile != nullptr){
+            continue;
+        }
+        std::unique_ptr<QLockFile> lockFile = std::make_unique<QLockFile>(directory.filePath(QString("journal%1.lock").arg(i)));
+        if(!lockFile->tryLock(0)){
+            continue;
+        }
+        if(isOrphan){
+            this->_orphans.append(Orphan{fileName, std::move(lockFile)});
+        }
+        else{
+            this->_lockFile = std::move(lockFile);
+            this->_fileName = fileName;
+        }
+    }
+}
+
+Journal::~Journal(){
+    this->_writer.waitForDone();
+}
+
+std::optional<Diagram> Journal::recover(QString *documentName){
+    TRACE_SCOPE("Journal::recover");
+    while(!this->_orphans.isEmpty()){
+        std::optional<Diagram> diagram = readJournal(this->_orphans.first().fileName, documentName);
+        if(diagram.has_value()){
+            return diagram;
+        }
+        this->discardRecovered();
+    }
+    return std::nullopt;
+}
+
+void Journal::discardRecovered(){
+    //When the changes were recovered, they must have been written to this instance's journal first
+    this->_writer.waitForDone();
+    if(!this->_orphans.isEmpty()){
+        QFile::remove(this->_orphans.first().fileName);
+        this->_orphans.removeFirst();
+    }
+}
+
+//Returns the diagram from a journal, if it has any unsaved changes
+std::optional<Diagram> Journal::readJournal(const QString &fileName, QString *documentName){
+    documentName->clear();
+    QFile file(fileName);
+    if(!file.open(QFile::ReadOnly)){
+        return std::nullopt;
+    }
+    QDataStream dataStream(&file);
+    quint32 fileMagicNumber;
+    quint16 fileVersion;
+    dataStream >> fileMagicNumber >> fileVersion;
+    if(dataStream.status() != QDataStream::Ok || fileMagicNumber != magicNumber || fileVersion > version){
+        return std::nullopt;
+    }
+
+    Diagram diagram;
+    bool isClean = true;
+    while(!dataStream.atEnd()){
+        quint32 size;
+        quint16 checksum;
+        dataStream >> size;
+        if(dataStream.status() != QDataStream::Ok || size > file.bytesAvailable()){
+            break;
+        }
+        QByteArray payload(size, Qt::Uninitialized);
+        dataStream.readRawData(payload.data(), int(size));
+        dataStream >> checksum;
+        if(dataStream.status() != QDataStream::Ok || checksum != qChecksum(payload)){
+            break;
+        }
+
+        QDataStream record(payload);
+        const quint8 recordType = payload.isEmpty() ? 0 : quint8(payload.front());
+        if(recordType == DocumentRecord){
+            record.skipRawData(1);
+            record >> *documentName >> isClean;
+            continue;
+        }
+        //The changes of a batch are all read before any of them is applied, so that a corrupt batch isn't partially applied
+        quint32 count = 1;
+        if(recordType == BatchRecord){
+            record.skipRawData(1);
+            record >> count;
+        }
+        QList<Change> changes;
+        Change next;
+        while(record.status() == QDataStream::Ok && changes.size() < qsizetype(count) && readChange(record, &next)){
+            changes.append(next);
+        }
+        if(changes.size() < qsizetype(count)){
+            break;
+        }
+        for(const Change &change: std::as_const(changes)){
+            if(change.particle == nullptr){
+                diagram.remove(change.id);
+            }
+            else if(diagram.contains(change.id)){
+                diagram.replace(change.id, change.particle);
+            }
+            else{
+                diagram.insert(change.id, change.particle);
+            }
+        }
+        isClean = false;
+    }
+    if(isClean){
+        return std::nullopt;
+    }
+    return diagram;
+}
+
+void Journal::record(const QList<Change> &changes){
+    TRACE_SCOPE("Journal::record");
+    if(changes.isEmpty()){
+        return;
+    }
+    QByteArray records;
+    if(this->_isClean){
+        appendDocumentRecord(&records, this->_documentName, false);
+        this->_isClean = false;
+    }
+    appendBatchRecord(&records, changes);
+    this->append(records);
+    this->_recordsSinceCompaction += changes.size();
+}
+
+void Journal::compact(const Diagram &diagram){
+    if(this->_fileName.isEmpty()){
+        return;
+    }
+    //Copying the diagram only copies pointers to the particles, the particles themselves are serialized on the writer thread
+    this->_writer.start([fileName = this->_fileName, diagram, documentName = this->_documentName, isClean = this->_isClean](){
+        TRACE_SCOPE("Journal::compact");
+        QByteArray records;
+        appendDocumentRecord(&records, documentName, false);
+        for(const Diagram::Entry &entry: diagram){
+            appendParticleRecord(&records, entry.id, entry.particle);
+        }
+        appendDocumentRecord(&records, documentName, isClean);
+
+        //The old journal is only replaced once the new one has been completely written
+        QSaveFile file(fileName);
+        if(file.open(QFile::WriteOnly)){
+            QDataStream dataStream(&file);
+            dataStream << magicNumber << version;
+            dataStream.writeRawData(records.constData(), int(records.size()));
+            file.commit();
+        }
+    });
+    this->_snapshotSize = diagram.size();
+    this->_recordsSinceCompaction = 0;
+}
+
+bool Journal::needsCompaction() const{
+    return this->_recordsSinceCompaction > qMax(minimumCompactionRecords, this->_snapshotSize);
+}
+
+void Journal::setDocument(const QString &documentName, bool isClean){
+    QByteArray records;
+    appendDocumentRecord(&records, documentName, isClean);
+    this->append(records);
+    this->_documentName = documentName;
+    this->_isClean = isClean;
+}
+
+void Journal::discard(){
+    this->_writer.waitForDone();
+    if(!this->_fileName.isEmpty()){
+        QFile::remove(this->_fileName);
+        this->_fileName.clear();
+    }
+}
+
+void Journal::append(const QByteArray &records){
+    if(this->_fileName.isEmpty()){
+        return;
+    }
+    this->_writer.start([fileName = this->_fileName, records](){
+        TRACE_SCOPE("Journal::append");
+        QFile file(fileName);
+        if(file.open(QFile::WriteOnly | QFile::Append)){
+            file.write(records);
+        }
+    });
+}
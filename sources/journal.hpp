@@ -0,0 +1,65 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <QByteArray>
+#include <QList>
+#include <QLockFile>
+#include <QString>
+#include <QThreadPool>
+
+#include <memory>
+#include <optional>
+
+#include "diagram.hpp"
+#include "particle.hpp"
+
+//Autosave journal used to recover unsaved changes after a crash.
+//Each edit is appended to the journal file as a small record by a background thread, so that the editor never waits for the disk. When the journal gets long compared to the diagram, it's rewritten as a snapshot of the whole diagram (also in the background) so that it doesn't grow indefinitely.
+//Each running instance uses its own journal, protected by a lock file. The journal is deleted when the program exits normally, so a journal that isn't locked by anyone was left behind by a crash.
+//Several instances may have crashed, so every journal left behind is locked at startup and offered for recovery in turn. A new instance never writes to one of them.
+class Journal{
+public:
+    struct Change{
+        Diagram::ParticleId id;
+        std::shared_ptr<const Particle> particle;    //Null when the particle was removed
+    };
+
+    Journal();
+    ~Journal();
+
+    //Returns the diagram from the next journal left behind by a crash that has unsaved changes, or nothing once there are none left. Journals without unsaved changes are deleted along the way.
+    std::optional<Diagram> recover(QString *documentName);
+    void discardRecovered();    //Deletes the journal last returned by recover(), once its changes were recovered or declined. Journals that aren't discarded are kept for the next instance.
+
+    void record(const QList<Change> &changes);    //The changes of one edit, which are written as a single record
+    void compact(const Diagram &diagram);
+    bool needsCompaction() const;
+    void setDocument(const QString &documentName, bool isClean);    //isClean means that the diagram is the same as the document that's saved on disk (or that it's a new empty document)
+    void discard();
+
+private:
+    struct Orphan{
+        QString fileName;
+        std::shared_ptr<QLockFile> lockFile;
+    };
+
+    static std::optional<Diagram> readJournal(const QString &fileName, QString *documentName);
+    void append(const QByteArray &records);
+
+    QString _fileName;
+    std::unique_ptr<QLockFile> _lockFile;
+    QList<Orphan> _orphans;    //Journals left behind by crashes, locked until they're discarded so that no other instance recovers them at the same time
+    QThreadPool _writer;    //Only has one thread so that records are written in the same order as they're recorded
+
+    QString _documentName;
+    bool _isClean;
+    qsizetype _snapshotSize;
+    qsizetype _recordsSinceCompaction;
+
+    static const quint32 magicNumber;
+    static const quint16 version;
+    static const qsizetype minimumCompactionRecords;
+    static const int maximumInstances;
+};
+
+#endif // JOURNAL_H
@@ -1,153 +1,229 @@
 #include "latexParser.hpp"
+#include "trace.hpp"
 
-#include <QRegularExpression>
-#include <QFontMetrics>
+#include <QCache>
 #include <QFontInfo>
+#include <QFontMetrics>
+#include <QMutex>
+#include <QVarLengthArray>
+
+#include <array>
+#include <string_view>
+
+using Tokens = QVarLengthArray<QStringView, 32>;
 
-const QStringList tokenize(const QString &latexCode){
-    QStringList toReturn("");
-    for(const QChar &character: latexCode){
-        if(toReturn.last().startsWith('{')){
-            if(toReturn.last().endsWith('}') && !toReturn.last().endsWith("\\}")){
-                toReturn.append("");
+//Splits LaTeX code into tokens without copying it. The tokens are consecutive slices of the code, so they're represented by where each one starts.
+void tokenize(QStringView latexCode, Tokens *tokens){
+    QVarLengthArray<qsizetype, 32> starts{0};
+    const auto token = [&](qsizetype index){
+        const qsizetype end = index + 1 < starts.size() ? starts[index + 1] : latexCode.size();
+        return latexCode.sliced(starts[index], end - starts[index]);
+    };
+    for(qsizetype i = 0; i < latexCode.size(); i++){
+        const QChar character = latexCode[i];
+        const QStringView last = latexCode.sliced(starts.last(), i - starts.last());
+        if(last.startsWith(u'{')){
+            if(last.endsWith(u'}') && !last.endsWith(u"\\}")){
+                starts.append(i);
             }
         }
-        else if(character == '\\' || toReturn.last() == "^" || toReturn.last() == "_"){
-            toReturn.append("");
+        else if(character == u'\\' || last == u"^" || last == u"_"){
+            starts.append(i);
         }
-        else if((character == '^' || character == '_') && !toReturn.last().endsWith("\\")){
-            toReturn.append("");
+        else if((character == u'^' || character == u'_') && !last.endsWith(u'\\')){
+            starts.append(i);
         }
-        else if(toReturn.last().startsWith('\\')){
-            static const QRegularExpression escapeRegex("^\\\\[_^{}:;]$");
-            if(toReturn.last().contains(escapeRegex)){
-                toReturn.append("");
+        else if(last.startsWith(u'\\')){
+            const bool isEscapeSequence = last.size() == 2 && QStringView(u"_^{}:;").contains(last[1]);
+            if(isEscapeSequence){
+                starts.append(i);
             }
-            else if(!character.isLetter() && (toReturn.last().length() >= 2 || (character != '_' && character != '^' && character != '{' && character != '}' && character != ':' && character != ';'))){
-                toReturn.append("");
+            else if(!character.isLetter() && (last.size() >= 2 || !QStringView(u"_^{}:;").contains(character))){
+                starts.append(i);
             }
         }
-        toReturn.last() += character;
-        if(toReturn.length() >= 2 && !toReturn.last().startsWith('{') && !toReturn.last().startsWith('\\') && (toReturn[toReturn.length() - 2] == "^" || toReturn[toReturn.length() - 2] == "_")){
-            toReturn.append("");
+        const QStringView current = latexCode.sliced(starts.last(), i + 1 - starts.last());
+        if(starts.size() >= 2 && !current.startsWith(u'{') && !current.startsWith(u'\\')){
+            const QStringView previous = token(starts.size() - 2);
+            if(previous == u"^" || previous == u"_"){
+                starts.append(i + 1);
+            }
         }
     }
-    return toReturn;
+    for(qsizetype i = 0; i < starts.size(); i++){
+        tokens->append(token(i));
+    }
 }
 
-QString latexSequenceToUnicode(const QString &token){
-    if(token == "\\alpha") return "α";
-    else if(token == "\\beta") return "β";
-    else if(token == "\\gamma") return "γ";
-    else if(token == "\\Gamma") return "Γ";
-    else if(token == "\\delta") return "δ";
-    else if(token == "\\Delta") return "Δ";
-    else if(token == "\\epsilon") return "ϵ";
-    else if(token == "\\varepsilon") return "ε";
-    else if(token == "\\zeta") return "ζ";
-    else if(token == "\\eta") return "η";
-    else if(token == "\\theta") return "θ";
-    else if(token == "\\vartheta") return "ϑ";
-    else if(token == "\\Theta") return "Θ";
-    else if(token == "\\iota") return "ι";
-    else if(token == "\\kappa") return "κ";
-    else if(token == "\\lambda") return "λ";
-    else if(token == "\\Lambda") return "Λ";
-    else if(token == "\\mu") return "µ";
-    else if(token == "\\nu") return "ν";
-    else if(token == "\\xi") return "ξ";
-    else if(token == "\\Xi") return "Ξ";
-    else if(token == "\\pi") return "π";
-    else if(token == "\\pi") return "Π";
-    else if(token == "\\rho") return "ρ";
-    else if(token == "\\varrho") return "ϱ";
-    else if(token == "\\sigma") return "σ";
-    else if(token == "\\Sigma") return "Σ";
-    else if(token == "\\tau") return "τ";
-    else if(token == "\\upsilon") return "υ";
-    else if(token == "\\Upsilon") return "ϒ";
-    else if(token == "\\phi") return "ϕ";
-    else if(token == "\\varphi") return "φ";
-    else if(token == "\\Phi") return "Φ";
-    else if(token == "\\chi") return "χ";
-    else if(token == "\\psi") return "ψ";
-    else if(token == "\\Psi") return "Ψ";
-    else if(token == "\\omega") return "ω";
-    else if(token == "\\Omega") return "Ω";
-    else if(token == "\\ell") return "ℓ";
-    else if(token == "\\pm") return "±";
-    else if(token == "\\:") return " ";
-    else if(token == "\\;") return "  ";
-    else if(token == "\\^") return "^";
-    else if(token == "\\_") return "_";
-    else if(token == "\\{") return "{";
-    else if(token == "\\}") return "}";
-    else if(token == "\\backslash") return "\\";
-    else return token;
+struct Symbol{
+    std::u16string_view latexSequence;
+    std::u16string_view unicode;
+};
+
+constexpr Symbol symbols[] = {
+    {u"\\alpha", u"α"},
+    {u"\\beta", u"β"},
+    {u"\\gamma", u"γ"},
+    {u"\\Gamma", u"Γ"},
+    {u"\\delta", u"δ"},
+    {u"\\Delta", u"Δ"},
+    {u"\\epsilon", u"ϵ"},
+    {u"\\varepsilon", u"ε"},
+    {u"\\zeta", u"ζ"},
+    {u"\\eta", u"η"},
+    {u"\\theta", u"θ"},
+    {u"\\vartheta", u"ϑ"},
+    {u"\\Theta", u"Θ"},
+    {u"\\iota", u"ι"},
+    {u"\\kappa", u"κ"},
+    {u"\\lambda", u"λ"},
+    {u"\\Lambda", u"Λ"},
+    {u"\\mu", u"µ"},
+    {u"\\nu", u"ν"},
+    {u"\\xi", u"ξ"},
+    {u"\\Xi", u"Ξ"},
+    {u"\\pi", u"π"},
+    {u"\\Pi", u"Π"},
+    {u"\\rho", u"ρ"},
+    {u"\\varrho", u"ϱ"},
+    {u"\\sigma", u"σ"},
+    {u"\\Sigma", u"Σ"},
+    {u"\\tau", u"τ"},
+    {u"\\upsilon", u"υ"},
+    {u"\\Upsilon", u"ϒ"},
+    {u"\\phi", u"ϕ"},
+    {u"\\varphi", u"φ"},
+    {u"\\Phi", u"Φ"},
+    {u"\\chi", u"χ"},
+    {u"\\psi", u"ψ"},
+    {u"\\Psi", u"Ψ"},
+    {u"\\omega", u"ω"},
+    {u"\\Omega", u"Ω"},
+    {u"\\ell", u"ℓ"},
+    {u"\\pm", u"±"},
+    {u"\\:", u" "},
+    {u"\\;", u"  "},
+    {u"\\^", u"^"},
+    {u"\\_", u"_"},
+    {u"\\{", u"{"},
+    {u"\\}", u"}"},
+    {u"\\backslash", u"\\"}
+};
+
+//FNV-1a hash, with a seed chosen so that all the symbols above end up in different slots of the table
+constexpr quint32 symbolHash(std::u16string_view latexSequence){
+    quint32 hash = 2166136261u ^ 122u;
+    for(const char16_t character: latexSequence){
+        hash ^= character;
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
-int width(Text text){
-    return QFontMetrics(text.font).size(0, text.text).width();
+constexpr qsizetype symbolTableSize = 256;
+
+constexpr std::array<const Symbol*, symbolTableSize> createSymbolTable(){
+    std::array<const Symbol*, symbolTableSize> table{};
+    for(const Symbol &symbol: symbols){
+        table[symbolHash(symbol.latexSequence) % symbolTableSize] = &symbol;
+    }
+    return table;
 }
 
-const QList<Text> parseLatex(const QString &latexCode, const QPoint &position, const QFont &font, bool centerHorizontally){
+constexpr std::array<const Symbol*, symbolTableSize> symbolTable = createSymbolTable();
+
+constexpr bool isPerfectHash(){
+    for(const Symbol &symbol: symbols){
+        if(symbolTable[symbolHash(symbol.latexSequence) % symbolTableSize] != &symbol){
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(isPerfectHash(), "Two LaTeX symbols have the same hash, change the seed in symbolHash");
+
+QStringView latexSequenceToUnicode(QStringView token){
+    const std::u16string_view latexSequence(token.utf16(), token.size());
+    const Symbol *symbol = symbolTable[symbolHash(latexSequence) % symbolTableSize];
+    if(symbol != nullptr && symbol->latexSequence == latexSequence){
+        return QStringView(symbol->unicode.data(), qsizetype(symbol->unicode.size()));
+    }
+    return token;
+}
+
+//Appends the text corresponding to a token, ignoring spaces in the LaTeX code
+void appendToken(QString *text, QStringView token, bool *bar){
+    const qsizetype start = text->size();
+    if(token.startsWith(u'\\')){
+        text->append(latexSequenceToUnicode(token));
+    }
+    else for(const QChar character: token){
+        if(character != u' '){
+            text->append(character);
+        }
+    }
+    if(*bar && text->size() > start){
+        text->insert(start + 1, QChar(0x305));    //Combining overline, which places a bar on top of the previous character
+    }
+    *bar = false;
+}
+
+bool isGroup(QStringView token){
+    return token.startsWith(u'{') && token.endsWith(u'}');
+}
+
+LatexLayout createLatexLayout(const QString &latexCode, const QFont &font, bool centerHorizontally){
     QFont subSuperScriptFont = font;
     subSuperScriptFont.setPointSizeF(QFontInfo(font).pointSizeF() * 0.75);
+    const QFontMetrics metrics(font), subSuperScriptMetrics(subSuperScriptFont);
+    const int pixelSize = QFontInfo(font).pixelSize();
+    const QPoint position(0, 0);
+    const auto width = [&](const Text &text){
+        return (text.font == font ? metrics : subSuperScriptMetrics).size(0, text.text).width();
+    };
 
     QList<Text> toReturn;
     int graphicalPosition = 0;
     bool inSubOrSuperScript = true;
     bool subscript = false, superscript = false;
     bool bar = false;
-    QStringList tokens;
-    for(const QString &token: tokenize(latexCode)){
-        if(token.startsWith('{') && token.endsWith('}')){
-            if(tokens.last() == "^" || tokens.last() == "_"){
-                tokens.append(QString(token).replace(" ", ""));
-            }
-            else for(const QString &subtoken: tokenize(token.mid(1, token.length() - 2))){
-                tokens.append(QString(subtoken).replace(" ", ""));
-            }
+    Tokens topLevelTokens, tokens;
+    tokenize(latexCode, &topLevelTokens);
+    for(const QStringView token: std::as_const(topLevelTokens)){
+        if(isGroup(token) && !(!tokens.isEmpty() && (tokens.last() == u"^" || tokens.last() == u"_"))){
+            tokenize(token.sliced(1, token.size() - 2), &tokens);
         }
         else{
-            tokens.append(QString(token).replace(" ", ""));
+            tokens.append(token);
         }
     }
-    for(const QString &token: qAsConst(tokens)){
-        if(token == "^" || token == "_"){
-            if(token == "^") superscript = true;
+    for(const QStringView token: std::as_const(tokens)){
+        if(token == u"^" || token == u"_"){
+            if(token == u"^") superscript = true;
             else subscript = true;
         }
-        else if(token == "\\bar"){
+        else if(token == u"\\bar"){
             bar = true;
         }
         else if(subscript || superscript){
             if(!toReturn.isEmpty()){
                 graphicalPosition += width(toReturn.last());
             }
-            if(token.startsWith('{') && token.endsWith('}')){
-                toReturn.append(Text("", position + QPoint(graphicalPosition, superscript ? -QFontInfo(font).pixelSize() / 2 : QFontInfo(font).pixelSize() / 3), subSuperScriptFont));
-                for(const QString &subtoken: tokenize(token.mid(1, token.length() - 2))){
-                    if(subtoken == "\\bar"){
+            toReturn.append(Text("", position + QPoint(graphicalPosition, superscript ? -pixelSize / 2 : pixelSize / 3), subSuperScriptFont));
+            if(isGroup(token)){
+                Tokens subtokens;
+                tokenize(token.sliced(1, token.size() - 2), &subtokens);
+                for(const QStringView subtoken: std::as_const(subtokens)){
+                    if(subtoken == u"\\bar"){
                         bar = true;
                     }
                     else{
-                        QString text = latexSequenceToUnicode(subtoken);
-                        if(bar){
-                            text.insert(1, "̅");
-                            bar = false;
-                        }
-                        toReturn.last().text += text;
+                        appendToken(&toReturn.last().text, subtoken, &bar);
                     }
                 }
             }
             else{
-                QString text = latexSequenceToUnicode(token);
-                if(bar){
-                    text.insert(1, "̅");
-                    bar = false;
-                }
-                toReturn.append(Text(text, position + QPoint(graphicalPosition, superscript ? -QFontInfo(font).pixelSize() / 2 : QFontInfo(font).pixelSize() / 3), subSuperScriptFont));
+                appendToken(&toReturn.last().text, token, &bar);
             }
             subscript = superscript = false;
             inSubOrSuperScript = true;
@@ -156,31 +232,69 @@ const QList<Text> parseLatex(const QString &latexCode, const QPoint &position, c
             if(!toReturn.isEmpty()){
                 graphicalPosition += width(toReturn.last());
             }
-            QString text = latexSequenceToUnicode(token);
-            if(bar){
-                text.insert(1, "̅");
-                bar = false;
-            }
-            toReturn.append(Text(text, position + QPoint(graphicalPosition, 0), font));
+            toReturn.append(Text("", position + QPoint(graphicalPosition, 0), font));
+            appendToken(&toReturn.last().text, token, &bar);
             inSubOrSuperScript = false;
         }
         else{
             if(toReturn.isEmpty()){
                 toReturn.append(Text("", position, font));
             }
-            QString text = latexSequenceToUnicode(token);
-            if(bar){
-                text.insert(1, "̅");    //The text editor might not render this very clearly, but "̅" is a string containing the Unicode 773 (0x305) character that places a bar on top of the previous character.
-                bar = false;
-            }
-            toReturn.last().text += text;
+            appendToken(&toReturn.last().text, token, &bar);
         }
     }
-    if(centerHorizontally){
+    if(!toReturn.isEmpty()){
         graphicalPosition += width(toReturn.last());
+    }
+    if(centerHorizontally){
         for(Text &text: toReturn){
             text.position -= QPoint(graphicalPosition / 2, 0);
         }
     }
+    int baseFontWidth = 0;
+    for(const Text &text: std::as_const(toReturn)){
+        baseFontWidth += metrics.size(0, text.text).width();
+    }
+    return LatexLayout{toReturn, graphicalPosition, baseFontWidth};
+}
+
+struct LatexLayoutKey{
+    QString latexCode;
+    QString font;
+    bool centerHorizontally;
+
+    bool operator==(const LatexLayoutKey &other) const{
+        return this->latexCode == other.latexCode && this->font == other.font && this->centerHorizontally == other.centerHorizontally;
+    }
+};
+
+size_t qHash(const LatexLayoutKey &key, size_t seed = 0){
+    return qHashMulti(seed, key.latexCode, key.font, key.centerHorizontally);
+}
+
+LatexLayout layoutLatex(const QString &latexCode, const QFont &font, bool centerHorizontally){
+    TRACE_SCOPE("layoutLatex");
+    //The same labels (for example e^- or \bar{q}) tend to be used many times in a diagram, so they're only laid out once. This can be called from several threads when exporting.
+    static QCache<LatexLayoutKey, LatexLayout> cache(4096);
+    static QMutex mutex;
+    const LatexLayoutKey key{latexCode, font.key(), centerHorizontally};
+    {
+        const QMutexLocker locker(&mutex);
+        const LatexLayout *cachedLayout = cache.object(key);
+        if(cachedLayout != nullptr){
+            return *cachedLayout;
+        }
+    }
+    const LatexLayout layout = createLatexLayout(latexCode, font, centerHorizontally);
+    const QMutexLocker locker(&mutex);
+    cache.insert(key, new LatexLayout(layout));
+    return layout;
+}
+
+const QList<Text> parseLatex(const QString &latexCode, const QPoint &position, const QFont &font, bool centerHorizontally){
+    QList<Text> toReturn = layoutLatex(latexCode, font, centerHorizontally).texts;
+    for(Text &text: toReturn){
+        text.position += position;
+    }
     return toReturn;
 }
@@ -14,6 +14,14 @@ struct Text{
     QFont font;
 };
 
+//Text positioned relative to the origin, along with its total width
+struct LatexLayout{
+    QList<Text> texts;
+    int width = 0;
+    int baseFontWidth = 0;    //Width of all the texts measured in the base font (even subscripts and superscripts), which is how far labels are moved when they're on the left of a particle
+};
+
+LatexLayout layoutLatex(const QString &latexCode, const QFont &font, bool centerHorizontally);
 const QList<Text> parseLatex(const QString &latexCode, const QPoint &position, const QFont &font, bool centerHorizontally);
 
 #endif // LATEXPARSER_H
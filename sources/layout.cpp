@@ -0,0 +1,229 @@
+#include "layout.hpp"
+
+#include <QLineF>
+#include <QList>
+#include <QPointF>
+#include <QSet>
+#include <QVarLengthArray>
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <algorithm>
+#include <limits>
+
+#include "trace.hpp"
+
+constexpr int iterations = 100;
+constexpr double springLength = 2;    //In grid cells, so that there's room for labels between nodes once they're snapped to the grid
+constexpr double theta = 0.8;    //Cells that are smaller than this fraction of their distance to a node act on it as a single charge
+constexpr double minimumCellSize = 1e-3;    //Nodes that are closer than this are put in the same cell instead of subdividing indefinitely
+
+enum class Side{Inside, Left, Right};
+
+struct Body{
+    int index;
+    QPointF position;
+    Side side = Side::Inside;
+    QPointF displacement;
+};
+
+//Quadtree used to approximate the repulsion between all the nodes in O(n log n) instead of O(n^2), as described by Barnes and Hut: the nodes in a cell that's far enough away act like a single charge at their center of mass.
+class QuadTree{
+public:
+    explicit QuadTree(const QList<Body> &bodies);
+
+    QPointF repulsion(const Body &body, double strength) const;
+
+private:
+    struct Cell{
+        QPointF center;
+        double halfSize;
+        double mass = 0;
+        QPointF weightedPosition;    //Sum of the positions of the nodes in the cell, divided by the mass to get the center of mass
+        int firstChild = -1;    //The four children are stored consecutively
+        int body = -1;    //Index of the only node in a leaf
+    };
+
+    void insert(const Body &body, const QList<Body> &bodies);
+    void split(int index, const QList<Body> &bodies);
+    static int quadrant(const Cell &cell, const QPointF &position);
+
+    QList<Cell> _cells;
+};
+
+QuadTree::QuadTree(const QList<Body> &bodies){
+    double minimumX = std::numeric_limits<double>::max(), minimumY = minimumX;
+    double maximumX = std::numeric_limits<double>::lowest(), maximumY = maximumX;
+    for(const Body &body: bodies){
+        minimumX = qMin(minimumX, body.position.x());
+        minimumY = qMin(minimumY, body.position.y());
+        maximumX = qMax(maximumX, body.position.x());
+        maximumY = qMax(maximumY, body.position.y());
+    }
+    this->_cells.reserve(bodies.size() * 2);
+    this->_cells.append(Cell{QPointF(minimumX + maximumX, minimumY + maximumY) / 2, qMax(maximumX - minimumX, maximumY - minimumY) / 2 + 1});
+    for(const Body &body: bodies){
+        this->insert(body, bodies);
+    }
+}
+
+QPointF QuadTree::repulsion(const Body &body, double strength) const{
+    QPointF force;
+    QVarLengthArray<int, 128> stack = {0};
+    while(!stack.isEmpty()){
+        const Cell &cell = this->_cells[stack.last()];
+        stack.removeLast();
+        if(cell.mass == 0 || cell.body == body.index){
+            continue;
+        }
+        const QPointF delta = body.position - cell.weightedPosition / cell.mass;
+        const double distanceSquared = QPointF::dotProduct(delta, delta);
+        const double size = 2 * cell.halfSize;
+        if(cell.firstChild < 0 || size * size < theta * theta * distanceSquared){
+            if(distanceSquared > minimumCellSize * minimumCellSize){
+                force += delta * (cell.mass * strength / distanceSquared);
+            }
+        }
+        else{
+            for(int i = 0; i < 4; i++){
+                stack.append(cell.firstChild + i);
+            }
+        }
+    }
+    return force;
+}
+
+void QuadTree::insert(const Body &body, const QList<Body> &bodies){
+    int index = 0;
+    while(true){
+        if(this->_cells[index].firstChild < 0){
+            Cell &leaf = this->_cells[index];
+            if(leaf.mass == 0 || leaf.halfSize < minimumCellSize){
+                leaf.body = leaf.mass == 0 ? body.index : -1;
+                leaf.mass += 1;
+                leaf.weightedPosition += body.position;
+                return;
+            }
+            this->split(index, bodies);
+        }
+        Cell &cell = this->_cells[index];
+        cell.mass += 1;
+        cell.weightedPosition += body.position;
+        index = cell.firstChild + quadrant(cell, body.position);
+    }
+}
+
+void QuadTree::split(int index, const QList<Body> &bodies){
+    //The node that was alone in the cell moves down to one of the new children
+    const Cell parent = this->_cells[index];
+    const int firstChild = int(this->_cells.size());
+    const double halfSize = parent.halfSize / 2;
+    for(int i = 0; i < 4; i++){
+        this->_cells.append(Cell{parent.center + QPointF(i & 1 ? halfSize : -halfSize, i & 2 ? halfSize : -halfSize), halfSize});
+    }
+    Cell &child = this->_cells[firstChild + quadrant(parent, bodies[parent.body].position)];
+    child.body = parent.body;
+    child.mass = parent.mass;
+    child.weightedPosition = parent.weightedPosition;
+    this->_cells[index].firstChild = firstChild;
+    this->_cells[index].body = -1;
+}
+
+int QuadTree::quadrant(const Cell &cell, const QPointF &position){
+    return (position.x() >= cell.center.x() ? 1 : 0) | (position.y() >= cell.center.y() ? 2 : 0);
+}
+
+QHash<QPoint, QPoint> layoutDiagram(const DiagramTopology &topology){
+    TRACE_SCOPE("layoutDiagram");
+    const QList<QPoint> nodes = topology.nodes();
+    if(nodes.isEmpty()){
+        return {};
+    }
+    const double gridSize = topology.gridSize();
+    const double idealLength = springLength * gridSize;
+
+    QHash<QPoint, int> indices;
+    QList<Body> bodies;
+    indices.reserve(nodes.size());
+    bodies.reserve(nodes.size());
+    double meanX = 0;
+    for(qsizetype i = 0; i < nodes.size(); i++){
+        indices.insert(nodes[i], int(i));
+        bodies.append(Body{int(i), QPointF(nodes[i])});
+        meanX += nodes[i].x();
+    }
+    meanX /= nodes.size();
+
+    //Each propagator is a spring between the nodes at its ends
+    QList<std::pair<int, int>> springs;
+    for(qsizetype i = 0; i < nodes.size(); i++){
+        for(const QPoint &neighbor: topology.neighbors(nodes[i])){
+            const int j = indices.value(neighbor);
+            if(i < j){
+                springs.append({int(i), j});
+            }
+        }
+    }
+
+    //The simulation takes place in a box that's big enough for all the nodes to be an ideal length apart, with the free ends of the external legs on its sides
+    const double width = idealLength * qSqrt(qreal(nodes.size()));
+    const double left = meanX - width / 2, right = meanX + width / 2;
+    for(Body &body: bodies){
+        if(topology.degree(nodes[body.index]) == 1){
+            body.side = body.position.x() < meanX ? Side::Left : Side::Right;
+            body.position.setX(body.side == Side::Left ? left : right);
+        }
+    }
+
+    //Fruchterman-Reingold simulation: the nodes move along the sum of the forces acting on them, but never further than a temperature that decreases over time
+    for(int iteration = 0; iteration < iterations; iteration++){
+        const QuadTree quadTree(bodies);
+        QtConcurrent::blockingMap(bodies, [&quadTree, idealLength](Body &body){
+            body.displacement = quadTree.repulsion(body, idealLength * idealLength);
+        });
+        for(const auto &[a, b]: std::as_const(springs)){
+            const QPointF delta = bodies[a].position - bodies[b].position;
+            const QPointF force = delta * (qSqrt(QPointF::dotProduct(delta, delta)) / idealLength);
+            bodies[a].displacement -= force;
+            bodies[b].displacement += force;
+        }
+
+        const double temperature = width / 10 * (iterations - iteration) / iterations;
+        for(Body &body: bodies){
+            const double length = qSqrt(QPointF::dotProduct(body.displacement, body.displacement));
+            if(length > 0){
+                body.position += body.displacement * (qMin(length, temperature) / length);
+            }
+            body.position.setX(body.side == Side::Left ? left : body.side == Side::Right ? right : qBound(left, body.position.x(), right));
+        }
+    }
+
+    //Snap the nodes to the grid, moving them to the closest free point when another node is already there. The external legs go first so that they stay on the sides.
+    std::stable_sort(bodies.begin(), bodies.end(), [](const Body &a, const Body &b){
+        return (a.side != Side::Inside) > (b.side != Side::Inside);
+    });
+    QHash<QPoint, QPoint> positions;
+    QSet<QPoint> occupied;
+    positions.reserve(nodes.size());
+    occupied.reserve(nodes.size());
+    for(const Body &body: std::as_const(bodies)){
+        const QPoint snapped = topology.snap(body.position.toPoint());
+        QPoint position = snapped;
+        for(int radius = 1; occupied.contains(position); radius++){
+            double closestDistance = std::numeric_limits<double>::max();
+            for(int dx = -radius; dx <= radius; dx++){
+                for(int dy = -radius; dy <= radius; dy++){
+                    const QPoint candidate = snapped + QPoint(dx, dy) * int(gridSize);
+                    const double distance = QLineF(candidate, body.position).length();
+                    if(qMax(qAbs(dx), qAbs(dy)) == radius && !occupied.contains(candidate) && distance < closestDistance){
+                        position = candidate;
+                        closestDistance = distance;
+                    }
+                }
+            }
+        }
+        occupied.insert(position);
+        positions.insert(nodes[body.index], position);
+    }
+    return positions;
+}
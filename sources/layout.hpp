@@ -0,0 +1,14 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <QHash>
+#include <QPoint>
+
+#include "topology.hpp"
+
+//Automatic layout of a diagram with a force-directed simulation: propagators pull the nodes they connect together like springs while all nodes repel each other like charges.
+//Returns the new position of every node of the topology, snapped to its grid. No two nodes get the same position, so moving the particles accordingly keeps the diagram's topology.
+//The nodes at the free end of an external leg are kept on the left or the right edge of the diagram, depending on which side of the diagram they're on to begin with.
+QHash<QPoint, QPoint> layoutDiagram(const DiagramTopology &topology);
+
+#endif // LAYOUT_H
@@ -10,25 +10,41 @@
 #include <QMessageBox>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
-#include <QPdfWriter>
+#include <QProgressDialog>
 #include <QRegularExpression>
 #include <QScreen>
-#include <QSvgRenderer>
-#include <QTemporaryDir>
 #include <QVersionNumber>
 #include <QToolBar>
 
 #include "mainwindow.hpp"
 #include "diagramviewer.hpp"
+#include "exporter.hpp"
+#include "journal.hpp"
+#include "textimporter.hpp"
+#include "trace.hpp"
 #include "version.h"
 
 //Local variables of the main function never go out of scope, so this warning is useless in this particular file (although it's useful in other files)
 //clazy:excludeall=lambda-in-connect
 
 int main(int argc, char **argv){
+    //In batch export mode, don't open any windows
+    bool batchExport = false;
+    for(int i = 1; i < argc; i++){
+        if(QByteArray(argv[i]) == "--export" || QByteArray(argv[i]).startsWith("--export=")){
+            batchExport = true;
+        }
+    }
+    if(batchExport){
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
     QApplication app(argc, argv);
     app.addLibraryPath("./");    //Otherwise weird things happen, see https://stackoverflow.com/a/25266269/4284627
 
+    if(batchExport){
+        return runBatchExport(app.arguments());
+    }
 
 
     //Check for updates
@@ -63,10 +79,13 @@ int main(int argc, char **argv){
     diagramViewer->setRenderHints(QPainter::Antialiasing | QPainter::SmoothPixmapTransform);
     mainWindow.setCentralWidget(diagramViewer);
 
+    Journal journal;
+
     QMenuBar menuBar;
     QMenu *fileMenu = menuBar.addMenu(QObject::tr("&File"));
     QAction *newAction = fileMenu->addAction(QIcon(":/icons/new.svg"), QObject::tr("&New Document"));
     QAction *openAction = fileMenu->addAction(QIcon(":/icons/open.svg"), QObject::tr("&Open..."));
+    QAction *importAction = fileMenu->addAction(QObject::tr("&Import text..."));
     fileMenu->addSeparator();
     QAction *saveAction = fileMenu->addAction(QIcon(":/icons/save.svg"), QObject::tr("&Save"));
     QAction *saveAsAction = fileMenu->addAction(QObject::tr("Save &As..."));
@@ -82,7 +101,47 @@ int main(int argc, char **argv){
     quitAction->setShortcut(QKeySequence("CTRL+Q"));
 
     QString currentFile;
-    QObject::connect(newAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, &currentFile, saveAction](){
+    const auto openFile = [&mainWindow, diagramViewer, &currentFile, &journal](const QString &fileName){
+        if(!QFile(fileName).open(QFile::ReadOnly)){
+            QMessageBox::critical(diagramViewer, "", QObject::tr("Could not open the file %1. You might not have sufficient permissions to read at this location.").arg(fileName));
+            return;
+        }
+        //Big files take a while to load, so show the progress and let the user cancel. The dialog is only shown if loading takes more than the minimum duration.
+        //A file that's still loading is canceled before connecting to the signals for this one, otherwise canceling it would close this dialog.
+        diagramViewer->cancelLoading();
+        QProgressDialog *progressDialog = new QProgressDialog(QObject::tr("Opening %1...").arg(fileName), QObject::tr("Cancel"), 0, 0, &mainWindow);
+        progressDialog->setWindowModality(Qt::WindowModal);
+        progressDialog->setMinimumDuration(500);
+        progressDialog->setAutoReset(false);
+        QObject::connect(diagramViewer, &DiagramViewer::loadingProgress, progressDialog, [progressDialog](int value, int maximum){
+            progressDialog->setMaximum(maximum);
+            progressDialog->setValue(value);
+        });
+        QObject::connect(diagramViewer, &DiagramViewer::loadingFinished, progressDialog, [&mainWindow, diagramViewer, &currentFile, &journal, progressDialog, fileName](bool ok){
+            progressDialog->deleteLater();
+            if(ok){
+                currentFile = fileName;
+                journal.setDocument(currentFile, true);
+                mainWindow.setWindowTitle(currentFile + " - FeynmanDiagramEditor");
+            }
+            else{
+                currentFile.clear();
+                journal.setDocument(currentFile, true);
+                mainWindow.setWindowTitle(QObject::tr("New document") + " - FeynmanDiagramEditor");
+                QMessageBox::critical(diagramViewer, "", QObject::tr("The file %1 is not a valid Feynman diagram file.").arg(fileName));
+            }
+        });
+        QObject::connect(diagramViewer, &DiagramViewer::loadingCanceled, progressDialog, &QObject::deleteLater);
+        QObject::connect(progressDialog, &QProgressDialog::canceled, diagramViewer, [&mainWindow, diagramViewer, &currentFile, &journal, progressDialog](){
+            progressDialog->deleteLater();
+            diagramViewer->clear();
+            currentFile.clear();
+            journal.setDocument(currentFile, true);
+            mainWindow.setWindowTitle(QObject::tr("New document") + " - FeynmanDiagramEditor");
+        });
+        diagramViewer->loadFile(fileName);
+    };
+    QObject::connect(newAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, &currentFile, &journal, saveAction](){
         if(mainWindow.windowTitle().startsWith("*")){
             switch(QMessageBox::warning(&mainWindow, "", QObject::tr("Do you want to save before quitting?"), QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel)){
             case QMessageBox::Yes:
@@ -95,9 +154,10 @@ int main(int argc, char **argv){
         diagramViewer->clear();
         diagramViewer->resetHistory();
         currentFile.clear();
+        journal.setDocument(currentFile, true);
         mainWindow.setWindowTitle(QObject::tr("New document") + " - FeynmanDiagramEditor");
     });
-    QObject::connect(openAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, &currentFile, saveAction](){
+    QObject::connect(openAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, saveAction, openFile](){
         if(mainWindow.windowTitle().startsWith("*")){
             switch(QMessageBox::warning(&mainWindow, "", QObject::tr("Do you want to save before quitting?"), QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel)){
             case QMessageBox::Yes:
@@ -109,26 +169,10 @@ int main(int argc, char **argv){
         }
         const QString chosenFile = QFileDialog::getOpenFileName(diagramViewer, QObject::tr("Open..."), "", QObject::tr("Feynman diagrams") + " (*.fdg)");
         if(!chosenFile.isEmpty()){
-            QFile file(chosenFile);
-            if(!file.open(QFile::ReadOnly)){
-                QMessageBox::critical(diagramViewer, "", QObject::tr("Could not open the file %1. You might not have sufficient permissions to read at this location.").arg(chosenFile));
-                return;
-            }
-            QDataStream dataStream(&file);
-            dataStream >> diagramViewer;
-            if(dataStream.status() == QDataStream::Ok){
-                currentFile = chosenFile;
-                mainWindow.setWindowTitle(currentFile + " - FeynmanDiagramEditor");
-            }
-            else{
-                currentFile.clear();
-                diagramViewer->clear();
-                diagramViewer->resetHistory();
-                QMessageBox::critical(diagramViewer, "", QObject::tr("The file %1 is not a valid Feynman diagram file.").arg(chosenFile));
-            }
+            openFile(chosenFile);
         }
     });
-    QObject::connect(saveAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, &currentFile, saveAsAction](){
+    QObject::connect(saveAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, &currentFile, &journal, saveAsAction](){
         if(currentFile.isEmpty()){
             saveAsAction->trigger();
         }
@@ -138,6 +182,7 @@ int main(int argc, char **argv){
                 QDataStream dataStream(&file);
                 dataStream << diagramViewer;
                 if(dataStream.status() == QDataStream::Ok){
+                    journal.setDocument(currentFile, true);
                     mainWindow.setWindowTitle(currentFile + " - FeynmanDiagramEditor");
                     return;
                 }
@@ -146,7 +191,7 @@ int main(int argc, char **argv){
             saveAsAction->trigger();
         }
     });
-    QObject::connect(saveAsAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, &currentFile](){
+    QObject::connect(saveAsAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer, &currentFile, &journal](){
         const QString chosenFile = QFileDialog::getSaveFileName(&mainWindow, QObject::tr("Save as..."), "", QObject::tr("Feynman diagram") + " (*.fdg)");
         if(!chosenFile.isEmpty()){
             QFile file(chosenFile);
@@ -155,6 +200,7 @@ int main(int argc, char **argv){
                 dataStream << diagramViewer;
                 if(dataStream.status() == QDataStream::Ok){
                     currentFile = chosenFile;
+                    journal.setDocument(currentFile, true);
                     mainWindow.setWindowTitle(currentFile + " - FeynmanDiagramEditor");
                 }
                 return;
@@ -162,40 +208,36 @@ int main(int argc, char **argv){
             QMessageBox::critical(diagramViewer, "", QObject::tr("Could not save the file %1. You might not have sufficient permissions to write at this location.").arg(chosenFile));
         }
     });
+    QObject::connect(importAction, &QAction::triggered, diagramViewer, [diagramViewer](){
+        const QString chosenFile = QFileDialog::getOpenFileName(diagramViewer, QObject::tr("Import text..."), "", QObject::tr("Feynman diagram text") + " (*.fdt);;" + QObject::tr("All files") + " (*)");
+        if(!chosenFile.isEmpty()){
+            QString errorMessage;
+            const std::optional<Diagram> diagram = importDiagramTextFile(chosenFile, &errorMessage);
+            if(diagram.has_value()){
+                diagramViewer->insertDiagram(*diagram);
+            }
+            else{
+                QMessageBox::critical(diagramViewer, "", errorMessage);
+            }
+        }
+    });
     QObject::connect(exportAction, &QAction::triggered, diagramViewer, [diagramViewer](){
-        const QString &svgCode = diagramViewer->toSvg();
-        if(svgCode.isEmpty()){
+        if(diagramViewer->diagram().svgRect().isNull()){
             QMessageBox::critical(diagramViewer, "", QObject::tr("This diagram is empty. Please draw something before exporting."));
             return;
         }
         QString chosenFormat;
         const QString chosenFile = QFileDialog::getSaveFileName(diagramViewer, QObject::tr("Export..."), "", QObject::tr("SVG image") + " (*.svg);;" + QObject::tr("PNG image") + " (*.png);;" + QObject::tr("PDF document") + " (*.pdf)", &chosenFormat);
         if(!chosenFile.isEmpty()){
-            QTemporaryDir temp;
-            QFile svgFile(chosenFormat.endsWith("(*.svg)") ? chosenFile : temp.path() + "/export.svg");
-            if(!svgFile.open(QFile::WriteOnly | QFile::Text) || svgFile.write(svgCode.toUtf8()) == -1){
-                QMessageBox::critical(diagramViewer, "", QObject::tr("Could not save the file %1. You might not have sufficient permissions to write at this location.").arg(chosenFile));
+            ExportFormat format = ExportFormat::Svg;
+            if(chosenFormat.endsWith("(*.png)")){
+                format = ExportFormat::Png;
             }
-            else if(!chosenFormat.endsWith("(*.svg)")){
-                svgFile.close();
-                const int width = QRegularExpression(" width=\"([0-9]+)\"").match(svgCode).captured(1).toInt();
-                const int height = QRegularExpression(" height=\"([0-9]+)\"").match(svgCode).captured(1).toInt();
-                QSvgRenderer renderer(svgFile.fileName());
-                if(chosenFormat.endsWith("(*.png)")){
-                    QImage image(width, height, QImage::Format_ARGB32);
-                    image.fill(Qt::white);
-                    QPainter painter(&image);
-                    renderer.render(&painter);
-                    if(!image.save(chosenFile, "png")){
-                        QMessageBox::critical(diagramViewer, "", QObject::tr("Could not save the file %1. You might not have sufficient permissions to write at this location.").arg(chosenFile));
-                    }
-                }
-                else if(chosenFormat.endsWith("(*.pdf)")){
-                    QPdfWriter pdfWriter(chosenFile);
-                    pdfWriter.setPageSize(QPageSize(QSize(width, height) * 72 / QGuiApplication::primaryScreen()->physicalDotsPerInch()));
-                    QPainter painter(&pdfWriter);
-                    renderer.render(&painter);
-                }
+            else if(chosenFormat.endsWith("(*.pdf)")){
+                format = ExportFormat::Pdf;
+            }
+            if(!exportDiagram(diagramViewer->diagram(), chosenFile, format, QGuiApplication::primaryScreen()->physicalDotsPerInch())){
+                QMessageBox::critical(diagramViewer, "", QObject::tr("Could not save the file %1. You might not have sufficient permissions to write at this location.").arg(chosenFile));
             }
         }
     });
@@ -228,12 +270,33 @@ int main(int argc, char **argv){
     QObject::connect(redo, &QAction::triggered, diagramViewer, &DiagramViewer::redo);
 
     editMenu->addSeparator();
+    QAction *autoLayoutAction = editMenu->addAction(QObject::tr("Automatic &layout"));
+    autoLayoutAction->setShortcut(QKeySequence("CTRL+L"));
+    QObject::connect(autoLayoutAction, &QAction::triggered, diagramViewer, &DiagramViewer::autoLayout);
+
+    editMenu->addSeparator();
+    QAction *selectAllAction = editMenu->addAction(QObject::tr("Select &all"));
+    selectAllAction->setShortcut(QKeySequence("CTRL+A"));
+    QObject::connect(selectAllAction, &QAction::triggered, diagramViewer, &DiagramViewer::selectAll);
     QAction *deselectAction = editMenu->addAction(QObject::tr("Deselect"));
     deselectAction->setShortcut(QKeySequence("Esc"));
     QObject::connect(deselectAction, &QAction::triggered, diagramViewer, &DiagramViewer::deselect);
 
+    //Until the progress dialog appears, the menus can still be used while a file is loading, but the diagram is incomplete and is being read by other threads, so it must not be edited, saved or exported
+    for(QAction *action: {saveAction, saveAsAction, importAction, exportAction, autoLayoutAction, selectAllAction}){
+        QObject::connect(diagramViewer, &DiagramViewer::loadingProgress, action, [action](){
+            action->setEnabled(false);
+        });
+        QObject::connect(diagramViewer, &DiagramViewer::loadingFinished, action, [action](){
+            action->setEnabled(true);
+        });
+        QObject::connect(diagramViewer, &DiagramViewer::loadingCanceled, action, [action](){
+            action->setEnabled(true);
+        });
+    }
+
     editMenu->addSeparator();
-    QAction *deleteAction = editMenu->addAction(QIcon(":/icons/delete.svg"), QObject::tr("Delete selected particle"));
+    QAction *deleteAction = editMenu->addAction(QIcon(":/icons/delete.svg"), QObject::tr("Delete selected particles"));
     deleteAction->setEnabled(false);
     deleteAction->setShortcut(QKeySequence("Del"));
 
@@ -247,11 +310,33 @@ int main(int argc, char **argv){
     gridAction->setCheckable(true);
     gridAction->setChecked(true);
     QObject::connect(gridAction, &QAction::triggered, diagramViewer, &DiagramViewer::setGridVisibiliy);
+    QAction *particleCachingAction = viewMenu->addAction(QObject::tr("&Cache particle images"));
+    particleCachingAction->setCheckable(true);
+    particleCachingAction->setChecked(false);
+    QObject::connect(particleCachingAction, &QAction::triggered, diagramViewer, &DiagramViewer::setParticleCaching);
+    QAction *compositingAction = viewMenu->addAction(QObject::tr("&Freeze diagram while drawing"));
+    compositingAction->setCheckable(true);
+    compositingAction->setChecked(true);
+    QObject::connect(compositingAction, &QAction::triggered, diagramViewer, &DiagramViewer::setInteractiveCompositing);
+
+    viewMenu->addSeparator();
+    QAction *zoomInAction = viewMenu->addAction(QObject::tr("Zoom &in"));
+    QAction *zoomOutAction = viewMenu->addAction(QObject::tr("Zoom &out"));
+    QAction *resetZoomAction = viewMenu->addAction(QObject::tr("&Reset zoom"));
+    zoomInAction->setShortcut(QKeySequence("CTRL++"));
+    zoomOutAction->setShortcut(QKeySequence("CTRL+-"));
+    resetZoomAction->setShortcut(QKeySequence("CTRL+0"));
+    QObject::connect(zoomInAction, &QAction::triggered, diagramViewer, &DiagramViewer::zoomIn);
+    QObject::connect(zoomOutAction, &QAction::triggered, diagramViewer, &DiagramViewer::zoomOut);
+    QObject::connect(resetZoomAction, &QAction::triggered, diagramViewer, &DiagramViewer::resetZoom);
 
     QMenu *helpMenu = menuBar.addMenu(QObject::tr("&Help"));
     QAction *helpAction = helpMenu->addAction(QObject::tr("&Help"));
     QAction *aboutAction = helpMenu->addAction(QObject::tr("&About FeynmanDiagramEditor"));
     QAction *aboutQtAction = helpMenu->addAction(QObject::tr("About &Qt"));
+    helpMenu->addSeparator();
+    QAction *recordTraceAction = helpMenu->addAction(QObject::tr("&Record performance trace"));
+    QAction *saveTraceAction = helpMenu->addAction(QObject::tr("&Save performance trace..."));
 
     helpAction->setShortcut(QKeySequence("F1"));
     QObject::connect(helpAction, &QAction::triggered, [](){
@@ -264,6 +349,24 @@ int main(int argc, char **argv){
         QMessageBox::aboutQt(&mainWindow);
     });
 
+    //Starting a new recording discards the previous one, so that the trace only contains what the user wants to profile
+    recordTraceAction->setCheckable(true);
+    QObject::connect(recordTraceAction, &QAction::toggled, [](bool checked){
+        if(checked){
+            Trace::clear();
+        }
+        Trace::setEnabled(checked);
+    });
+    QObject::connect(saveTraceAction, &QAction::triggered, &mainWindow, [&mainWindow](){
+        const QString chosenFile = QFileDialog::getSaveFileName(&mainWindow, QObject::tr("Save performance trace..."), "", QObject::tr("Chrome trace") + " (*.json)");
+        if(!chosenFile.isEmpty()){
+            QFile file(chosenFile);
+            if(!file.open(QFile::WriteOnly) || !Trace::writeChromeJson(&file)){
+                QMessageBox::critical(&mainWindow, "", QObject::tr("Could not save the file %1. You might not have sufficient permissions to write at this location.").arg(chosenFile));
+            }
+        }
+    });
+
     mainWindow.setMenuBar(&menuBar);
 
     QToolBar fileToolbar(QObject::tr("&File"));
@@ -394,27 +497,17 @@ int main(int argc, char **argv){
     particleToolbar.addWidget(labelEditor);
     particleToolbar.addSeparator();
 
-    QObject::connect(diagramViewer, &DiagramViewer::particleSelected, labelEditor, [labelEditor, deleteAction](const Particle &particle){
-        labelEditor->setEnabled(true);
-        deleteAction->setEnabled(true);
-        labelEditor->setText(particle.labelText());
+    QObject::connect(diagramViewer, &DiagramViewer::selectionChanged, labelEditor, [labelEditor, deleteAction](qsizetype count, const QString &labelText){
+        labelEditor->setEnabled(count > 0);
+        deleteAction->setEnabled(count > 0);
+        labelEditor->setText(labelText);
     });
-    QObject::connect(diagramViewer, &DiagramViewer::particleDeselected, labelEditor, [labelEditor, deleteAction](){
-        labelEditor->clear();
-        labelEditor->setEnabled(false);
-        deleteAction->setEnabled(false);
-    });
-    QObject::connect(labelEditor, &QLineEdit::textEdited, diagramViewer, [&mainWindow, diagramViewer](const QString &text){
+    QObject::connect(labelEditor, &QLineEdit::textEdited, diagramViewer, &DiagramViewer::editSelectedLabels);
+    QObject::connect(deleteAction, &QAction::triggered, diagramViewer, &DiagramViewer::deleteSelectedParticles);
+    QObject::connect(diagramViewer, &DiagramViewer::diagramEdited, &mainWindow, [&mainWindow](){
         if(!mainWindow.windowTitle().startsWith("*")){
             mainWindow.setWindowTitle("*" + mainWindow.windowTitle());
         }
-        diagramViewer->editSelectedLabel(text);
-    });
-    QObject::connect(deleteAction, &QAction::triggered, diagramViewer, [&mainWindow, diagramViewer](){
-        if(!mainWindow.windowTitle().startsWith("*")){
-            mainWindow.setWindowTitle("*" + mainWindow.windowTitle());
-        }
-        diagramViewer->deleteSelectedParticle();
     });
     mainWindow.addToolBar(&particleToolbar);
 
@@ -434,28 +527,37 @@ int main(int argc, char **argv){
         }
     });
 
-    if(argc >= 2){
-        QFile file(argv[1]);
-        if(!file.open(QFile::ReadOnly)){
-            QMessageBox::critical(diagramViewer, "", QObject::tr("Could not open the file %1. You might not have sufficient permissions to read at this location.").arg(argv[1]));
+    mainWindow.showMaximized();
+
+    //If the program crashed last time, the journals it left behind contain the unsaved changes. They're offered one by one, the ones that come after the recovered one are offered again next time.
+    QString recoveredFile;
+    std::optional<Diagram> recoveredDiagram;
+    bool isRecovered = false;
+    while(!isRecovered && (recoveredDiagram = journal.recover(&recoveredFile)).has_value()){
+        const QString documentName = recoveredFile.isEmpty() ? QObject::tr("a new document") : recoveredFile;
+        isRecovered = QMessageBox::question(&mainWindow, "", QObject::tr("FeynmanDiagramEditor was closed unexpectedly.<br/><br/>Do you want to recover the unsaved changes to %1?").arg(documentName)) == QMessageBox::Yes;
+        if(!isRecovered){
+            journal.discardRecovered();
         }
-        else{
-            QDataStream dataStream(&file);
-            dataStream >> diagramViewer;
-            if(dataStream.status() == QDataStream::Ok){
-                currentFile = argv[1];
-                mainWindow.setWindowTitle(currentFile + " - FeynmanDiagramEditor");
-            }
-            else{
-                currentFile.clear();
-                diagramViewer->clear();
-                diagramViewer->resetHistory();
-                QMessageBox::critical(diagramViewer, "", QObject::tr("The file %1 is not a valid Feynman diagram file.").arg(argv[1]));
-            }
+    }
+    if(isRecovered){
+        currentFile = recoveredFile;
+        diagramViewer->setDiagram(*recoveredDiagram);
+        journal.setDocument(currentFile, false);
+        diagramViewer->setJournal(&journal);
+        //The changes are in this instance's journal now
+        journal.discardRecovered();
+        mainWindow.setWindowTitle("*" + (currentFile.isEmpty() ? QObject::tr("New document") : currentFile) + " - FeynmanDiagramEditor");
+    }
+    else{
+        diagramViewer->setJournal(&journal);
+        journal.setDocument(currentFile, true);
+        if(argc >= 2){
+            openFile(QString::fromLocal8Bit(argv[1]));
         }
     }
 
-    mainWindow.showMaximized();
-
-    return app.exec();
+    const int exitCode = app.exec();
+    journal.discard();
+    return exitCode;
 }
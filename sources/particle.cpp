@@ -3,8 +3,12 @@
 #include <QFont>
 #include <QFontInfo>
 #include <QFontMetrics>
+#include <QFontMetricsF>
+
+#include <array>
 
 #include "latexParser.hpp"
+#include "trace.hpp"
 
 constexpr const int Particle::lineWidth = 3;
 constexpr const int Particle::vertexSize = 5;
@@ -16,6 +20,28 @@ constexpr const int Hadron::margin = 10;
 Particle::Particle(const QPoint &from, const QPoint &to): _from(from), _to(to){}
 Particle::~Particle(){}
 
+std::unique_ptr<Particle> Particle::create(ParticleType type, const QPoint &from, const QPoint &to){
+    switch(type){
+    case Fermion:
+        return std::make_unique<class Fermion>(from, to);
+    case Photon:
+        return std::make_unique<class Photon>(from, to);
+    case WeakBoson:
+        return std::make_unique<class WeakBoson>(from, to);
+    case Gluon:
+        return std::make_unique<class Gluon>(from, to);
+    case Higgs:
+        return std::make_unique<class Higgs>(from, to);
+    case GenericBoson:
+        return std::make_unique<class GenericBoson>(from, to);
+    case Hadron:
+        return std::make_unique<class Hadron>(from, to);
+    case Vertex:
+        return std::make_unique<class Vertex>(from);
+    }
+    return nullptr;
+}
+
 bool Particle::operator==(const Particle &other) const{
     return this->_from == other._from && this->_to == other._to;
 }
@@ -24,12 +50,49 @@ QPoint Particle::startingPoint() const{
     return this->_from;
 }
 
+QPoint Particle::endPoint() const{
+    return this->_to;
+}
+
+void Particle::setStartingPoint(const QPoint &from){
+    if(from != this->_from){
+        this->_from = from;
+        this->_geometry = Geometry();
+    }
+}
+
 void Particle::setEndPoint(const QPoint &to){
-    this->_to = to;
+    if(to != this->_to){
+        this->_to = to;
+        this->_geometry = Geometry();
+    }
+}
+
+void Particle::translate(const QPoint &offset){
+    this->_from += offset;
+    this->_to += offset;
+    //The label is placed from the rounded normal of the particle, so it doesn't necessarily move by the same offset and has to be generated again
+    if(!this->_labelText.isEmpty()){
+        this->_geometry = Geometry();
+        return;
+    }
+    //Without a label, the shape of a particle doesn't depend on its position, so the cached paths can simply be moved along with it instead of being generated again
+    for(std::optional<QPainterPath> *painterPath: {&this->_geometry.painterPath, &this->_geometry.simplifiedPainterPath, &this->_geometry.minimalPainterPath}){
+        if(painterPath->has_value()){
+            (*painterPath)->translate(offset);
+        }
+    }
+    if(this->_geometry.boundingRect.has_value()){
+        this->_geometry.boundingRect->translate(offset);
+    }
+    this->_geometry.svgCode.reset();
 }
 
 void Particle::setLabelText(const QString &text){
-    this->_labelText = text;
+    if(text != this->_labelText){
+        this->_labelText = text;
+        this->_geometry = Geometry();
+    }
 }
 
 QString Particle::labelText() const{
@@ -43,95 +106,179 @@ QDataStream &operator<<(QDataStream &dataStream, const Particle &particle){
 
 QDataStream &operator>>(QDataStream &dataStream, Particle &particle){
     dataStream >> particle._from >> particle._to >> particle._labelText;
+    particle._geometry = Geometry();
     return dataStream;
 }
 
+QString Particle::svgCode() const{
+    if(!this->_geometry.svgCode.has_value()){
+        TRACE_SCOPE("Particle::createSvgCode");
+        this->_geometry.svgCode = this->createSvgCode();
+    }
+    return *this->_geometry.svgCode;
+}
+
+QPainterPath Particle::painterPath() const{
+    if(!this->_geometry.painterPath.has_value()){
+        TRACE_SCOPE("Particle::createPainterPath");
+        this->_geometry.painterPath = this->createPainterPath();
+    }
+    return *this->_geometry.painterPath;
+}
+
+QPainterPath Particle::painterPath(DetailLevel detailLevel) const{
+    if(detailLevel == DetailLevel::Full){
+        return this->painterPath();
+    }
+    std::optional<QPainterPath> &painterPath = detailLevel == DetailLevel::Simplified ? this->_geometry.simplifiedPainterPath : this->_geometry.minimalPainterPath;
+    if(!painterPath.has_value()){
+        TRACE_SCOPE("Particle::createSimplifiedPainterPath");
+        painterPath = this->createSimplifiedPainterPath(detailLevel);
+    }
+    return *painterPath;
+}
+
+QPainterPath Particle::createSimplifiedPainterPath(DetailLevel) const{
+    //Most particles are already simple enough to be drawn in full detail at any zoom level
+    return this->painterPath();
+}
+
+QRectF Particle::boundingRect() const{
+    if(!this->_geometry.boundingRect.has_value()){
+        this->_geometry.boundingRect = this->createBoundingRect();
+    }
+    return *this->_geometry.boundingRect;
+}
+
+qsizetype Particle::memoryUsage() const{
+    //The cached geometry is usually much bigger than the particle itself, so it's included in the estimate
+    qsizetype usage = sizeof(*this) + this->_labelText.size() * sizeof(QChar);
+    if(this->_geometry.svgCode.has_value()){
+        usage += this->_geometry.svgCode->size() * sizeof(QChar);
+    }
+    for(const std::optional<QPainterPath> *painterPath: {&this->_geometry.painterPath, &this->_geometry.simplifiedPainterPath, &this->_geometry.minimalPainterPath}){
+        if(painterPath->has_value()){
+            usage += (*painterPath)->elementCount() * sizeof(QPainterPath::Element);
+        }
+    }
+    return usage;
+}
+
 QVector2D Particle::direction() const{
     return QVector2D(this->_to - this->_from).normalized();
 }
 
 QVector2D Particle::normal() const{
-    return QVector2D(this->direction().y(), -this->direction().x()).normalized();
+    const QVector2D direction = this->direction();
+    return QVector2D(direction.y(), -direction.x());
 }
 
-void Particle::addLabel(QPainterPath *path, QString *svgCode) const{
+const QList<Text> Particle::labelTexts() const{
     if(this->labelText().isEmpty()){
-        return;
+        return QList<Text>();
     }
-    QFont defaultFont("Arial");
+    const QFont defaultFont("Arial");
+    const int pixelSize = QFontInfo(defaultFont).pixelSize();
     QVector2D normal = this->normal();
     if(normal.x() < 0 && !dynamic_cast<const class Hadron*>(this)){
         normal = -normal;
     }
-    QPoint anchorPoint = (this->_from + this->_to) / 2 + (normal * QFontInfo(defaultFont).pixelSize() * 0.5 * (1 + (normal.y() > 0) + (dynamic_cast<const Boson*>(this) != nullptr))).toPoint();
+    QPoint anchorPoint = (this->_from + this->_to) / 2 + (normal * pixelSize * 0.5 * (1 + (normal.y() > 0) + (dynamic_cast<const Boson*>(this) != nullptr))).toPoint();
     if(dynamic_cast<const class Vertex*>(this)){
-        anchorPoint += QPoint(0, QFontInfo(defaultFont).pixelSize());
+        anchorPoint += QPoint(0, pixelSize);
     }
     if(dynamic_cast<const class Hadron*>(this)){
         anchorPoint += (this->normal() * 15).toPoint();
     }
+    const LatexLayout layout = layoutLatex(this->labelText(), defaultFont, normal.x() == 0);
     if(normal.x() < 0){
-        for(const Text &text: parseLatex(this->labelText(), anchorPoint, defaultFont, normal.x() == 0)){
-            anchorPoint -= QPoint((normal.x() < 0) ? QFontMetrics(defaultFont).size(0, text.text).width() : 0, 0);
+        anchorPoint -= QPoint(layout.baseFontWidth, 0);
+    }
+    QList<Text> toReturn = layout.texts;
+    for(Text &text: toReturn){
+        text.position += anchorPoint;
+    }
+    return toReturn;
+}
+
+QRectF Particle::labelBoundingRect() const{
+    QRectF toReturn;
+    for(const Text &text: this->labelTexts()){
+        const QFontMetricsF metrics(text.font);
+        //The height is doubled to leave room for bars above the characters
+        toReturn |= QRectF(text.position.x(), text.position.y() - metrics.ascent() * 2, metrics.horizontalAdvance(text.text), metrics.ascent() * 2 + metrics.descent());
+    }
+    return toReturn;
+}
+
+QRectF Particle::paddedBoundingRect(qreal padding) const{
+    return QRectF(QPointF(this->_from), QPointF(this->_to)).normalized().adjusted(-padding, -padding, padding, padding) | this->labelBoundingRect();
+}
+
+void appendEscapedXml(QString *xml, QStringView text){
+    //Only a few ASCII characters need to be escaped, everything outside of ASCII is written as a character reference
+    static constexpr std::array<const char*, 128> asciiEscapes = [](){
+        std::array<const char*, 128> toReturn{};
+        toReturn['&'] = "&amp;";
+        toReturn['<'] = "&lt;";
+        toReturn['>'] = "&gt;";
+        toReturn['"'] = "&quot;";
+        toReturn[' '] = "&#160;";
+        return toReturn;
+    }();
+    for(qsizetype i = 0; i < text.size(); i++){
+        const char16_t character = text[i].unicode();
+        if(character < asciiEscapes.size()){
+            if(asciiEscapes[character] != nullptr){
+                xml->append(QLatin1String(asciiEscapes[character]));
+            }
+            else{
+                xml->append(QChar(character));
+            }
+        }
+        else{
+            char32_t codePoint = character;
+            if(QChar::isHighSurrogate(character) && i + 1 < text.size() && text[i + 1].isLowSurrogate()){
+                codePoint = QChar::surrogateToUcs4(character, text[i + 1].unicode());
+                i++;
+            }
+            if(codePoint == 0xB5){
+                codePoint = 0x3BC;    //\mu is written with the micro sign (U+00B5) but exported as the Greek letter (U+03BC)
+            }
+            xml->append(QString("&#%1;").arg(quint32(codePoint)));
         }
     }
-    for(const Text &text: parseLatex(this->labelText(), anchorPoint, defaultFont, normal.x() == 0)){
+}
+
+void Particle::addLabel(QPainterPath *path, QString *svgCode) const{
+    for(const Text &text: this->labelTexts()){
         if(path != nullptr){
             path->addText(text.position, text.font, text.text);
         }
         if(svgCode != nullptr){
-            *svgCode += QString("<text x=\"%1\" y=\"%2\" style=\"font-size:%3pt;font-family:%4\">%5</text>").arg(text.position.x()).arg(text.position.y()).arg(QFontInfo(text.font).pointSizeF()).arg(QFontInfo(text.font).family(), text.text.toHtmlEscaped().replace(" ", "&#160;"))
-                 .replace("α", "&#945;")
-                 .replace("β", "&#946;")
-                 .replace("γ", "&#947;")
-                 .replace("Γ", "&#915;")
-                 .replace("δ", "&#948;")
-                 .replace("Δ", "&#916;")
-                 .replace("ϵ", "&#1013;")
-                 .replace("ε", "&#949;")
-                 .replace("ζ", "&#950;")
-                 .replace("η", "&#951;")
-                 .replace("θ", "&#952;")
-                 .replace("ϑ", "&#977;")
-                 .replace("Θ", "&#920;")
-                 .replace("ι", "&#953;")
-                 .replace("κ", "&#954;")
-                 .replace("λ", "&#955;")
-                 .replace("Λ", "&#923;")
-                 .replace("µ", "&#956;")
-                 .replace("ν", "&#957;")
-                 .replace("ξ", "&#958;")
-                 .replace("Ξ", "&#926;")
-                 .replace("π", "&#960;")
-                 .replace("Π", "&#928;")
-                 .replace("ρ", "&#961;")
-                 .replace("ϱ", "&#1009;")
-                 .replace("σ", "&#963;")
-                 .replace("Σ", "&#931;")
-                 .replace("τ", "&#964;")
-                 .replace("υ", "&#965;")
-                 .replace("ϒ", "&#978;")
-                 .replace("ϕ", "&#981;")
-                 .replace("φ", "&#966;")
-                 .replace("Φ", "&#934;")
-                 .replace("χ", "&#967;")
-                 .replace("ψ", "&#968;")
-                 .replace("Ψ", "&#936;")
-                 .replace("ω", "&#969;")
-                 .replace("Ω", "&#937;")
-                 .replace("±", "&#177;")
-                 .replace("̅", "&#773;");
+            const QFontInfo fontInfo(text.font);
+            *svgCode += QString("<text x=\"%1\" y=\"%2\" style=\"font-size:%3pt;font-family:%4\">").arg(text.position.x()).arg(text.position.y()).arg(fontInfo.pointSizeF()).arg(fontInfo.family());
+            appendEscapedXml(svgCode, text.text);
+            *svgCode += "</text>";
         }
     }
 }
 
+std::unique_ptr<Particle> Fermion::clone() const{
+    return std::make_unique<Fermion>(*this);
+}
+
+Particle::ParticleType Fermion::type() const{
+    return Particle::Fermion;
+}
+
 const QList<QPoint> Fermion::arrowPoints() const{
     const QPoint arrowBack = (this->_from + this->_to) / 2 - (this->direction() * arrowSize / 2).toPoint();
     const QPoint arrowFront = (this->_from + this->_to) / 2 + (this->direction() * arrowSize / 2).toPoint();
     return QList<QPoint>({arrowBack + (this->normal() * arrowSize / 2).toPoint(), arrowFront, arrowBack - (this->normal() * arrowSize / 2).toPoint()});
 }
 
-QString Fermion::svgCode() const{
+QString Fermion::createSvgCode() const{
     QString toReturn = QString("<line x1=\"%1\" y1=\"%2\" x2=\"%3\" y2=\"%4\" fill=\"none\" stroke=\"black\" stroke-width=\"2\"/>").arg(this->_from.x()).arg(this->_from.y()).arg(this->_to.x()).arg(this->_to.y());
     toReturn += "<polygon fill=\"black\" stroke=\"none\" points=\"";
     for(const QPoint &point: this->arrowPoints()){
@@ -142,7 +289,7 @@ QString Fermion::svgCode() const{
     return toReturn;
 }
 
-QPainterPath Fermion::painterPath() const{
+QPainterPath Fermion::createPainterPath() const{
     QPainterPathStroker stroker;
     stroker.setWidth(lineWidth);
     QPainterPath lines;
@@ -161,35 +308,110 @@ QPainterPath Fermion::painterPath() const{
     return path;
 }
 
-const QList<QPoint> Boson::points() const{
-    const int length = QVector2D(this->_to - this->_from).length();
-    QList<QPoint> toReturn;
-    for(int i = spacing / 2; i < length; i += spacing){
-        toReturn.append(this->_from + (i * this->direction() + ((((i / spacing) % 2) ? this->normal() : -this->normal())) * spacing).toPoint());
+QRectF Fermion::createBoundingRect() const{
+    return this->paddedBoundingRect(arrowSize / 2 + lineWidth);
+}
+
+//One segment of a boson's wave: a cubic Bézier curve, or a straight line to end for weak bosons
+struct WaveSegment{
+    QPoint control1, control2, end;
+};
+
+template<Boson::Waveform waveform>
+void generateWaveform(const QPoint &from, const QPoint &to, int spacing, QList<WaveSegment> *segments){
+    //The frame is computed once, then each peak only depends on its index so the loop has no dependencies between iterations
+    const QVector2D difference(to - from);
+    const int length = difference.length();
+    const QVector2D direction = difference.normalized();
+    const QVector2D normal(direction.y(), -direction.x());
+    const qsizetype peakCount = length > spacing / 2 ? (length - spacing / 2 - 1) / spacing + 1 : 0;
+    segments->resize(peakCount + 1);
+    WaveSegment *data = segments->data();
+    for(qsizetype k = 0; k < peakCount; k++){
+        const int i = spacing / 2 + int(k) * spacing;
+        data[k].end = from + (i * direction + (k % 2 ? normal : -normal) * spacing).toPoint();
+    }
+    data[peakCount].end = to;
+
+    if constexpr(waveform != Boson::Waveform::ZigZag){
+        //The control points go half a spacing along the line from each peak, and gluons alternate between going forwards and backwards to make loops
+        const QPoint displacement = (direction * spacing / 2).toPoint();
+        for(qsizetype k = 0; k <= peakCount; k++){
+            const QPoint &point = data[k].end;
+            const QPoint previousPoint = k ? data[k - 1].end : from - displacement;
+            if(waveform == Boson::Waveform::Wave || k == 0){
+                data[k].control1 = previousPoint + displacement;
+                data[k].control2 = point == to ? point : point - displacement;
+            }
+            else if(k % 2){
+                data[k].control1 = previousPoint + displacement * 2;
+                data[k].control2 = point == to ? point : point + displacement * 2;
+            }
+            else{
+                data[k].control1 = previousPoint - displacement * 2;
+                data[k].control2 = point == to ? point : point - displacement * 2;
+            }
+        }
     }
-    toReturn.append(this->_to);
-    return toReturn;
 }
 
-QString WeakBoson::svgCode() const{
-    QString toReturn = QString("<path fill=\"none\" stroke=\"black\" stroke-width=\"2\" d=\"M%1 %2").arg(this->_from.x()).arg(this->_from.y());
-    for(const QPoint &point: this->points()){
-        toReturn += QString("L%1 %2").arg(point.x()).arg(point.y());
+//The same buffer is reused every time a wave is generated on a given thread, so long bosons don't allocate a list of points every time
+QList<WaveSegment> &waveSegmentBuffer(){
+    thread_local QList<WaveSegment> buffer;
+    return buffer;
+}
+
+void appendSvgPoint(QString *svgCode, const QPoint &point){
+    *svgCode += QString::number(point.x());
+    *svgCode += ' ';
+    *svgCode += QString::number(point.y());
+}
+
+template<Boson::Waveform waveform>
+QString Boson::waveformSvgCode() const{
+    QList<WaveSegment> &segments = waveSegmentBuffer();
+    generateWaveform<waveform>(this->_from, this->_to, spacing, &segments);
+
+    QString toReturn = "<path fill=\"none\" stroke=\"black\" stroke-width=\"2\" d=\"M";
+    toReturn.reserve(toReturn.size() + segments.size() * (waveform == Waveform::ZigZag ? 10 : 30) + 16);
+    appendSvgPoint(&toReturn, this->_from);
+    for(const WaveSegment &segment: std::as_const(segments)){
+        if constexpr(waveform == Waveform::ZigZag){
+            toReturn += 'L';
+        }
+        else{
+            toReturn += 'C';
+            appendSvgPoint(&toReturn, segment.control1);
+            toReturn += ',';
+            appendSvgPoint(&toReturn, segment.control2);
+            toReturn += ',';
+        }
+        appendSvgPoint(&toReturn, segment.end);
     }
     toReturn += "\"/>";
     this->addLabel(nullptr, &toReturn);
     return toReturn;
 }
 
-QPainterPath WeakBoson::painterPath() const{
-    QPainterPathStroker stroker;
-    stroker.setWidth(lineWidth);
+template<Boson::Waveform waveform>
+QPainterPath Boson::waveformPainterPath() const{
+    QList<WaveSegment> &segments = waveSegmentBuffer();
+    generateWaveform<waveform>(this->_from, this->_to, spacing, &segments);
+
     QPainterPath lines;
+    lines.reserve(int(segments.size() * (waveform == Waveform::ZigZag ? 1 : 3) + 1));
     lines.moveTo(this->_from);
-    for(const QPoint &point: this->points()){
-        lines.lineTo(point);
+    for(const WaveSegment &segment: std::as_const(segments)){
+        if constexpr(waveform == Waveform::ZigZag){
+            lines.lineTo(segment.end);
+        }
+        else{
+            lines.cubicTo(segment.control1, segment.control2, segment.end);
+        }
     }
 
+    QPainterPathStroker stroker;
+    stroker.setWidth(lineWidth);
     QPainterPath path;
     path.setFillRule(Qt::WindingFill);
     path.addPath(stroker.createStroke(lines));
@@ -197,66 +419,102 @@ QPainterPath WeakBoson::painterPath() const{
     return path;
 }
 
-void Photon::iterateOverPoints(const std::function<void(const QPoint&, const QPoint&, const QPoint&)> &callback) const{
-    const QPoint displacement = (this->direction() * spacing / 2).toPoint();
-    QPoint previousPoint = this->_from - displacement;
-    for(const QPoint &point: this->points()){
-        callback(previousPoint + displacement, (point == this->_to ? point : point - displacement), point);
-        previousPoint = point;
-    }
+std::unique_ptr<Particle> WeakBoson::clone() const{
+    return std::make_unique<WeakBoson>(*this);
 }
 
-void Gluon::iterateOverPoints(const std::function<void(const QPoint&, const QPoint&, const QPoint&)> &callback) const{
-    const QPoint displacement = (this->direction() * spacing / 2).toPoint();
-    const QList<QPoint> &points = this->points();
-    for(int i = 0; i < points.size(); i++){
-        const QPoint &point = points[i];
-        const QPoint &previousPoint = i ? points[i - 1] : (this->_from - displacement);
-        if(i == 0){
-            callback(previousPoint + displacement, (point == this->_to ? point : point - displacement), point);
-        }
-        else if(i % 2){
-            callback(previousPoint + displacement * 2, (point == this->_to ? point : point + displacement * 2), point);
-        }
-        else{
-            callback(previousPoint - displacement * 2, (point == this->_to ? point : point - displacement * 2), point);
-        }
-    }
+Particle::ParticleType WeakBoson::type() const{
+    return Particle::WeakBoson;
 }
 
-QString MasslessBoson::svgCode() const{
-    QString toReturn = QString("<path fill=\"none\" stroke=\"black\" stroke-width=\"2\" d=\"M%1 %2").arg(this->_from.x()).arg(this->_from.y());
-    this->iterateOverPoints([&toReturn](const QPoint &c1, const QPoint &c2, const QPoint &end){
-        toReturn += QString("C%1 %2,%3 %4,%5 %6").arg(c1.x()).arg(c1.y()).arg(c2.x()).arg(c2.y()).arg(end.x()).arg(end.y());
-    });
-    toReturn += "\"/>";
-    this->addLabel(nullptr, &toReturn);
-    return toReturn;
+QRectF Boson::createBoundingRect() const{
+    return this->paddedBoundingRect(spacing + lineWidth);
+}
+
+QString WeakBoson::createSvgCode() const{
+    return this->waveformSvgCode<Waveform::ZigZag>();
+}
+
+QPainterPath WeakBoson::createPainterPath() const{
+    return this->waveformPainterPath<Waveform::ZigZag>();
+}
+
+std::unique_ptr<Particle> Photon::clone() const{
+    return std::make_unique<Photon>(*this);
+}
+
+Particle::ParticleType Photon::type() const{
+    return Particle::Photon;
+}
+
+QString Photon::createSvgCode() const{
+    return this->waveformSvgCode<Waveform::Wave>();
+}
+
+QPainterPath Photon::createPainterPath() const{
+    return this->waveformPainterPath<Waveform::Wave>();
+}
+
+std::unique_ptr<Particle> Gluon::clone() const{
+    return std::make_unique<Gluon>(*this);
+}
+
+Particle::ParticleType Gluon::type() const{
+    return Particle::Gluon;
+}
+
+QString Gluon::createSvgCode() const{
+    return this->waveformSvgCode<Waveform::Loops>();
+}
+
+QPainterPath Gluon::createPainterPath() const{
+    return this->waveformPainterPath<Waveform::Loops>();
 }
 
-QPainterPath MasslessBoson::painterPath() const{
+QRectF MasslessBoson::createBoundingRect() const{
+    //The control points of the Bézier curves can be up to two spacings away from the line
+    return this->paddedBoundingRect(spacing * 2 + lineWidth);
+}
+
+QPainterPath MasslessBoson::createSimplifiedPainterPath(DetailLevel detailLevel) const{
+    //When the peaks are only a few pixels apart, a zig-zag looks the same as the curves but has far fewer path elements
+    if(detailLevel == DetailLevel::Simplified){
+        return this->waveformPainterPath<Waveform::ZigZag>();
+    }
+
+    //When the peaks can't be told apart at all, draw a thick line where the wave would be as a hint that it's a boson
     QPainterPathStroker stroker;
-    stroker.setWidth(lineWidth);
-    QPainterPath lines;
-    lines.moveTo(this->_from);
-    this->iterateOverPoints([&lines](const QPoint &c1, const QPoint &c2, const QPoint &end){
-        lines.cubicTo(c1, c2, end);
-    });
+    stroker.setWidth(spacing);
+    QPainterPath line;
+    line.moveTo(this->_from);
+    line.lineTo(this->_to);
 
     QPainterPath path;
     path.setFillRule(Qt::WindingFill);
-    path.addPath(stroker.createStroke(lines));
+    path.addPath(stroker.createStroke(line));
     this->addLabel(&path, nullptr);
     return path;
 }
 
-QString Higgs::svgCode() const{
+std::unique_ptr<Particle> Higgs::clone() const{
+    return std::make_unique<Higgs>(*this);
+}
+
+Particle::ParticleType Higgs::type() const{
+    return Particle::Higgs;
+}
+
+QRectF Higgs::createBoundingRect() const{
+    return this->paddedBoundingRect(lineWidth);
+}
+
+QString Higgs::createSvgCode() const{
     QString toReturn = QString("<line x1=\"%1\" y1=\"%2\" x2=\"%3\" y2=\"%4\" fill=\"none\" stroke=\"black\" stroke-width=\"2\" stroke-dasharray=\"%5\"/>").arg(this->_from.x()).arg(this->_from.y()).arg(this->_to.x()).arg(this->_to.y()).arg(dashLength);
     this->addLabel(nullptr, &toReturn);
     return toReturn;
 }
 
-QPainterPath Higgs::painterPath() const{
+QPainterPath Higgs::createPainterPath() const{
     QPainterPathStroker stroker;
     stroker.setWidth(lineWidth);
     QPainterPath lines;
@@ -278,13 +536,25 @@ QPainterPath Higgs::painterPath() const{
     return path;
 }
 
-QString GenericBoson::svgCode() const{
+std::unique_ptr<Particle> GenericBoson::clone() const{
+    return std::make_unique<GenericBoson>(*this);
+}
+
+Particle::ParticleType GenericBoson::type() const{
+    return Particle::GenericBoson;
+}
+
+QRectF GenericBoson::createBoundingRect() const{
+    return this->paddedBoundingRect(lineWidth);
+}
+
+QString GenericBoson::createSvgCode() const{
     QString toReturn = QString("<line x1=\"%1\" y1=\"%2\" x2=\"%3\" y2=\"%4\" fill=\"none\" stroke=\"black\" stroke-width=\"2\"/>").arg(this->_from.x()).arg(this->_from.y()).arg(this->_to.x()).arg(this->_to.y());
     this->addLabel(nullptr, &toReturn);
     return toReturn;
 }
 
-QPainterPath GenericBoson::painterPath() const{
+QPainterPath GenericBoson::createPainterPath() const{
     QPainterPathStroker stroker;
     stroker.setWidth(lineWidth);
     QPainterPath line;
@@ -298,13 +568,26 @@ QPainterPath GenericBoson::painterPath() const{
     return path;
 }
 
-QString Hadron::svgCode() const{
+std::unique_ptr<Particle> Hadron::clone() const{
+    return std::make_unique<Hadron>(*this);
+}
+
+Particle::ParticleType Hadron::type() const{
+    return Particle::Hadron;
+}
+
+QRectF Hadron::createBoundingRect() const{
+    //The corners are at a distance of sqrt(2) * margin from the endpoints
+    return this->paddedBoundingRect(margin * 2 + lineWidth);
+}
+
+QString Hadron::createSvgCode() const{
     QString toReturn = QString("<path d=\"M%1 %2L%3 %4L%5 %6L%7 %8\" fill=\"none\" stroke=\"black\" stroke-width=\"2\"/>").arg(this->_from.x() + (-this->direction() * margin).x()).arg(this->_from.y() + (-this->direction() * margin).y()).arg(this->_from.x() + (this->normal() * margin - this->direction() * margin).x()).arg(this->_from.y() + (this->normal() * margin - this->direction() * margin).y()).arg(this->_to.x() + (this->normal() * margin + this->direction() * margin).x()).arg(this->_to.y() + (this->normal() * margin + this->direction() * margin).y()).arg(this->_to.x() + (this->direction() * margin).x()).arg(this->_to.y() + (this->direction() * margin).y());
     this->addLabel(nullptr, &toReturn);
     return toReturn;
 }
 
-QPainterPath Hadron::painterPath() const{
+QPainterPath Hadron::createPainterPath() const{
     QPainterPathStroker stroker;
     stroker.setWidth(lineWidth);
     QPainterPath line;
@@ -322,13 +605,25 @@ QPainterPath Hadron::painterPath() const{
 
 Vertex::Vertex(const QPoint &point): Particle(point, point){}
 
-QString Vertex::svgCode() const{
+std::unique_ptr<Particle> Vertex::clone() const{
+    return std::make_unique<Vertex>(*this);
+}
+
+Particle::ParticleType Vertex::type() const{
+    return Particle::Vertex;
+}
+
+QRectF Vertex::createBoundingRect() const{
+    return this->paddedBoundingRect(vertexSize + lineWidth);
+}
+
+QString Vertex::createSvgCode() const{
     QString toReturn;
     this->addLabel(nullptr, &toReturn);
     return toReturn;
 }
 
-QPainterPath Vertex::painterPath() const{
+QPainterPath Vertex::createPainterPath() const{
     QPainterPath path;
     path.setFillRule(Qt::WindingFill);
     path.addEllipse(this->_from, vertexSize, vertexSize);
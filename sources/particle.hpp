@@ -4,22 +4,36 @@
 #include <QString>
 #include <QPainterPath>
 #include <QVector2D>
-#include <functional>
+#include <memory>
+#include <optional>
+
+#include "latexParser.hpp"
 
 class Particle{
 public:
     enum ParticleType{Fermion, Photon, WeakBoson, Gluon, Higgs, GenericBoson, Hadron, Vertex};
+    enum class DetailLevel{Full, Simplified, Minimal};    //Lower detail levels are used on screen when zoomed out, exported images always use full detail
 
     Particle(const QPoint &from = QPoint(), const QPoint &to = QPoint());
     virtual ~Particle();
 
+    static std::unique_ptr<Particle> create(ParticleType type, const QPoint &from, const QPoint &to = QPoint());
+    virtual std::unique_ptr<Particle> clone() const = 0;
+    virtual ParticleType type() const = 0;
+
     bool operator==(const Particle &other) const;
 
     QPoint startingPoint() const;
+    QPoint endPoint() const;
+    void setStartingPoint(const QPoint &from);
     void setEndPoint(const QPoint &to);
+    void translate(const QPoint &offset);
 
-    virtual QString svgCode() const = 0;
-    virtual QPainterPath painterPath() const = 0;
+    QString svgCode() const;
+    QPainterPath painterPath() const;
+    QPainterPath painterPath(DetailLevel detailLevel) const;
+    QRectF boundingRect() const;
+    qsizetype memoryUsage() const;
 
     void setLabelText(const QString &text);
     QString labelText() const;
@@ -28,9 +42,17 @@ public:
     friend QDataStream &operator>>(QDataStream &dataStream, Particle &particle);
 
 protected:
+    virtual QString createSvgCode() const = 0;
+    virtual QPainterPath createPainterPath() const = 0;
+    virtual QRectF createBoundingRect() const = 0;
+    virtual QPainterPath createSimplifiedPainterPath(DetailLevel detailLevel) const;
+
     QVector2D direction() const;
     QVector2D normal() const;
 
+    QRectF paddedBoundingRect(qreal padding) const;
+    QRectF labelBoundingRect() const;
+    const QList<Text> labelTexts() const;
     void addLabel(QPainterPath *path, QString *svgCode) const;
 
     QPoint _from, _to;
@@ -38,15 +60,29 @@ protected:
     static const int lineWidth, vertexSize;
 
 private:
+    //Cached results of svgCode(), painterPath() and boundingRect(), which only depend on the type, the endpoints and the label. They're cleared when the endpoints or the label change, and moved along with the particle when it's translated.
+    struct Geometry{
+        std::optional<QString> svgCode;
+        std::optional<QPainterPath> painterPath;
+        std::optional<QPainterPath> simplifiedPainterPath, minimalPainterPath;
+        std::optional<QRectF> boundingRect;
+    };
+
     QString _labelText;
+    mutable Geometry _geometry;
 };
 
 class Fermion: public Particle{
 public:
     using Particle::Particle;
 
-    QString svgCode() const override;
-    QPainterPath painterPath() const override;
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
+
+protected:
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
+    QRectF createBoundingRect() const override;
 
 private:
     const QList<QPoint> arrowPoints() const;
@@ -58,8 +94,14 @@ class Boson: public Particle{
 public:
     using Particle::Particle;
 
+    //Bosons are drawn as a wave around the line between the endpoints. Weak bosons use straight lines between the peaks, photons and gluons use Bézier curves.
+    enum class Waveform{ZigZag, Wave, Loops};
+
 protected:
-    const QList<QPoint> points() const;
+    QRectF createBoundingRect() const override;
+
+    template<Waveform waveform> QString waveformSvgCode() const;
+    template<Waveform waveform> QPainterPath waveformPainterPath() const;
 
     static const int spacing;
 };
@@ -68,43 +110,58 @@ class MasslessBoson: public Boson{
 public:
     using Boson::Boson;
 
-    QString svgCode() const override;
-    QPainterPath painterPath() const override;
-
 protected:
-    virtual void iterateOverPoints(const std::function<void(const QPoint&, const QPoint&, const QPoint&)> &callback) const = 0;
+    QRectF createBoundingRect() const override;
+    QPainterPath createSimplifiedPainterPath(DetailLevel detailLevel) const override;
 };
 
 class Photon: public MasslessBoson{
 public:
     using MasslessBoson::MasslessBoson;
 
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
+
 protected:
-    void iterateOverPoints(const std::function<void(const QPoint&, const QPoint&, const QPoint&)> &callback) const override;
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
 };
 
 class Gluon: public MasslessBoson{
 public:
     using MasslessBoson::MasslessBoson;
 
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
+
 protected:
-    void iterateOverPoints(const std::function<void(const QPoint&, const QPoint&, const QPoint&)> &callback) const override;
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
 };
 
 class WeakBoson: public Boson{
 public:
     using Boson::Boson;
 
-    QString svgCode() const override;
-    QPainterPath painterPath() const override;
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
+
+protected:
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
 };
 
 class Higgs: public Particle{
 public:
     using Particle::Particle;
 
-    QString svgCode() const override;
-    QPainterPath painterPath() const override;
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
+
+protected:
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
+    QRectF createBoundingRect() const override;
 
 private:
     static const int dashLength;
@@ -114,18 +171,27 @@ class GenericBoson: public Particle{
 public:
     using Particle::Particle;
 
-    QString svgCode() const override;
-    QPainterPath painterPath() const override;
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
+
+protected:
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
+    QRectF createBoundingRect() const override;
 };
 
 class Hadron: public Particle{
 public:
     using Particle::Particle;
 
-    QString svgCode() const override;
-    QPainterPath painterPath() const override;
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
 
 protected:
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
+    QRectF createBoundingRect() const override;
+
     static const int margin;
 };
 
@@ -133,8 +199,13 @@ class Vertex: public Particle{
 public:
     Vertex(const QPoint &point = QPoint());
 
-    QString svgCode() const override;
-    QPainterPath painterPath() const override;
+    std::unique_ptr<Particle> clone() const override;
+    ParticleType type() const override;
+
+protected:
+    QString createSvgCode() const override;
+    QPainterPath createPainterPath() const override;
+    QRectF createBoundingRect() const override;
 };
 
 #endif // PARTICLE_H
@@ -0,0 +1,35 @@
+#include "particleitem.hpp"
+
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+#include "trace.hpp"
+
+//Scales below which the waves of photons and gluons are only a few pixels wide (simplified) or less than about a pixel wide (minimal)
+const qreal ParticleItem::simplifiedDetailScale = 0.6;
+const qreal ParticleItem::minimalDetailScale = 0.2;
+
+ParticleItem::ParticleItem(std::shared_ptr<const Particle> particle):
+    QGraphicsPathItem(particle->painterPath())
+{
+    this->_particle = std::move(particle);
+    this->setPen(Qt::NoPen);
+    this->setBrush(Qt::black);
+}
+
+void ParticleItem::setParticle(std::shared_ptr<const Particle> particle){
+    this->setPath(particle->painterPath());
+    this->_particle = std::move(particle);
+}
+
+void ParticleItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget){
+    const qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    if(scale >= simplifiedDetailScale){
+        QGraphicsPathItem::paint(painter, option, widget);
+        return;
+    }
+    TRACE_SCOPE("ParticleItem::paint");
+    painter->setPen(this->pen());
+    painter->setBrush(this->brush());
+    painter->drawPath(this->_particle->painterPath(scale < minimalDetailScale ? Particle::DetailLevel::Minimal : Particle::DetailLevel::Simplified));
+}
@@ -0,0 +1,26 @@
+#ifndef PARTICLEITEM_H
+#define PARTICLEITEM_H
+
+#include <QGraphicsPathItem>
+
+#include <memory>
+
+#include "particle.hpp"
+
+//The graphics item showing a particle in a DiagramViewer.
+//When zoomed out, it's drawn with a lower level of detail. Its shape and bounding rect are always those of the full detail path so that selecting particles works the same at all zoom levels.
+class ParticleItem: public QGraphicsPathItem{
+public:
+    explicit ParticleItem(std::shared_ptr<const Particle> particle);
+
+    void setParticle(std::shared_ptr<const Particle> particle);
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
+private:
+    std::shared_ptr<const Particle> _particle;
+
+    static const qreal simplifiedDetailScale, minimalDetailScale;
+};
+
+#endif // PARTICLEITEM_H
@@ -0,0 +1,250 @@
+#include "textimporter.hpp"
+
+#include <QFile>
+#include <QHash>
+#include <QObject>
+#include <QPoint>
+
+#include <algorithm>
+
+#include "particle.hpp"
+#include "trace.hpp"
+
+constexpr qsizetype averageLineLength = 24;    //Used to estimate the number of particles from the size of the text without going through it
+
+constexpr std::pair<const char*, Particle::ParticleType> particleTypeNames[] = {
+    {"fermion", Particle::Fermion}, {"photon", Particle::Photon}, {"weakboson", Particle::WeakBoson}, {"gluon", Particle::Gluon},
+    {"higgs", Particle::Higgs}, {"genericboson", Particle::GenericBoson}, {"hadron", Particle::Hadron}, {"vertex", Particle::Vertex}
+};
+
+//Splits the text into lines and the lines into tokens. Tokens are views of the text, so reading them doesn't allocate anything.
+class DiagramTextReader{
+public:
+    explicit DiagramTextReader(QByteArrayView text): _text(text), _position(0), _lineEnd(0), _nextLine(0), _lineNumber(0){}
+
+    //Moves to the next line that isn't empty or a comment, returns false at the end of the text
+    bool nextLine(){
+        while(this->_nextLine < this->_text.size()){
+            this->_position = this->_nextLine;
+            this->_lineEnd = this->_text.indexOf('\n', this->_position);
+            if(this->_lineEnd < 0){
+                this->_lineEnd = this->_text.size();
+            }
+            this->_nextLine = this->_lineEnd + 1;
+            this->_lineNumber++;
+            this->skipSpaces();
+            if(this->_position < this->_lineEnd && this->_text[this->_position] != '#'){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //Returns the next token on the current line (a label including its quotes, or a word), or an empty view at the end of the line
+    QByteArrayView token(){
+        this->skipSpaces();
+        const qsizetype start = this->_position;
+        if(start >= this->_lineEnd || this->_text[start] == '#'){
+            return {};
+        }
+        if(this->_text[start] == '"'){
+            this->_position++;
+            while(this->_position < this->_lineEnd && this->_text[this->_position] != '"'){
+                this->_position += isEscape(this->_text.sliced(this->_position, this->_lineEnd - this->_position)) ? 2 : 1;
+            }
+            this->_position = qMin(this->_position + 1, this->_lineEnd);
+        }
+        else{
+            while(this->_position < this->_lineEnd && !isSpace(this->_text[this->_position]) && this->_text[this->_position] != '"' && this->_text[this->_position] != '#'){
+                this->_position++;
+            }
+        }
+        return this->_text.sliced(start, this->_position - start);
+    }
+
+    int lineNumber() const{
+        return this->_lineNumber;
+    }
+
+    //Whether the text starts with a backslash that escapes a double quote or another backslash. Other backslashes are part of the LaTeX code.
+    static bool isEscape(QByteArrayView text){
+        return text.size() >= 2 && text[0] == '\\' && (text[1] == '"' || text[1] == '\\');
+    }
+
+private:
+    static bool isSpace(char c){
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    void skipSpaces(){
+        while(this->_position < this->_lineEnd && isSpace(this->_text[this->_position])){
+            this->_position++;
+        }
+    }
+
+    QByteArrayView _text;
+    qsizetype _position, _lineEnd, _nextLine;
+    int _lineNumber;
+};
+
+bool parseInteger(QByteArrayView text, int *value){
+    const bool negative = text.startsWith('-');
+    if(negative){
+        text = text.sliced(1);
+    }
+    if(text.isEmpty() || text.size() > 9){    //Nine digits always fit in an int
+        return false;
+    }
+    int result = 0;
+    for(char c: text){
+        if(c < '0' || c > '9'){
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    *value = negative ? -result : result;
+    return true;
+}
+
+bool parseCoordinates(QByteArrayView text, QPoint *point){
+    const qsizetype comma = text.indexOf(',');
+    int x, y;
+    if(comma < 0 || !parseInteger(text.first(comma), &x) || !parseInteger(text.sliced(comma + 1), &y)){
+        return false;
+    }
+    *point = QPoint(x, y);
+    return true;
+}
+
+//Reads a label token including its quotes, returns false if it isn't terminated by a double quote
+bool parseLabel(QByteArrayView token, QString *label){
+    QByteArray text;
+    text.reserve(token.size());
+    for(qsizetype i = 1; i < token.size(); i++){
+        if(token[i] == '"'){
+            *label = QString::fromUtf8(text);
+            return i == token.size() - 1;
+        }
+        if(DiagramTextReader::isEscape(token.sliced(i))){
+            i++;
+        }
+        text.append(token[i]);
+    }
+    return false;
+}
+
+bool isName(QByteArrayView text){
+    const auto isNameCharacter = [](char c){
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    };
+    return !text.isEmpty() && !(text[0] >= '0' && text[0] <= '9') && std::all_of(text.begin(), text.end(), isNameCharacter);
+}
+
+std::optional<Diagram> importDiagramText(QByteArrayView text, QString *errorMessage){
+    TRACE_SCOPE("importDiagramText");
+    DiagramTextReader reader(text);
+    Diagram diagram;
+    diagram.reserve(text.size() / averageLineLength + 1);
+    QHash<QByteArrayView, QPoint> points;    //The names are views of the text, which outlives the hash
+
+    const auto fail = [&reader, errorMessage](const QString &message){
+        if(errorMessage != nullptr){
+            *errorMessage = QObject::tr("Line %1: %2").arg(reader.lineNumber()).arg(message);
+        }
+        return std::nullopt;
+    };
+    //An endpoint is either coordinates or the name of a point that has already been defined
+    const auto readEndpoint = [&points](QByteArrayView token, QPoint *point){
+        if(parseCoordinates(token, point)){
+            return true;
+        }
+        const auto it = points.constFind(token);
+        if(it == points.cend()){
+            return false;
+        }
+        *point = it.value();
+        return true;
+    };
+
+    while(reader.nextLine()){
+        const QByteArrayView keyword = reader.token();
+        QByteArrayView token = reader.token();
+
+        if(keyword.compare("point", Qt::CaseInsensitive) == 0){
+            QPoint point;
+            if(!isName(token) || !parseCoordinates(reader.token(), &point)){
+                return fail(QObject::tr("Expected a name and coordinates after \"point\"."));
+            }
+            points.insert(token, point);
+            token = reader.token();
+        }
+        else{
+            const auto type = std::find_if(std::begin(particleTypeNames), std::end(particleTypeNames), [keyword](const auto &typeName){
+                return keyword.compare(typeName.first, Qt::CaseInsensitive) == 0;
+            });
+            if(type == std::end(particleTypeNames)){
+                return fail(QObject::tr("Unknown particle type \"%1\".").arg(QString::fromUtf8(keyword)));
+            }
+
+            QPoint from, to;
+            if(type->second == Particle::Vertex){
+                //A vertex with a name and coordinates defines a new point, otherwise it's drawn at an existing point
+                QByteArrayView coordinates = reader.token();
+                if(isName(token) && parseCoordinates(coordinates, &from)){
+                    points.insert(token, from);
+                    token = reader.token();
+                }
+                else if(readEndpoint(token, &from)){
+                    token = coordinates;
+                }
+                else{
+                    return fail(QObject::tr("Expected coordinates or the name of a point after \"%1\".").arg(QString::fromUtf8(keyword)));
+                }
+                to = from;
+            }
+            else{
+                if(!readEndpoint(token, &from) || !readEndpoint(reader.token(), &to)){
+                    return fail(QObject::tr("Expected two endpoints after \"%1\", each made of coordinates or the name of a point.").arg(QString::fromUtf8(keyword)));
+                }
+                if(from == to){
+                    return fail(QObject::tr("A %1 can't start and end at the same point.").arg(QString::fromUtf8(keyword)));
+                }
+                token = reader.token();
+            }
+
+            std::unique_ptr<Particle> particle = Particle::create(type->second, from, to);
+            if(token.startsWith('"')){
+                QString label;
+                if(!parseLabel(token, &label)){
+                    return fail(QObject::tr("The label isn't terminated by a double quote."));
+                }
+                particle->setLabelText(label);
+                token = reader.token();
+            }
+            diagram.insert(std::move(particle));
+        }
+
+        if(!token.isEmpty()){
+            return fail(QObject::tr("Unexpected \"%1\" at the end of the line.").arg(QString::fromUtf8(token)));
+        }
+    }
+    return diagram;
+}
+
+std::optional<Diagram> importDiagramTextFile(const QString &fileName, QString *errorMessage){
+    QFile file(fileName);
+    if(!file.open(QFile::ReadOnly)){
+        if(errorMessage != nullptr){
+            *errorMessage = QObject::tr("Could not open the file %1. You might not have sufficient permissions to read at this location.").arg(fileName);
+        }
+        return std::nullopt;
+    }
+    //Memory mapping the file avoids copying it, the text is then only read once by the parser
+    const qint64 size = file.size();
+    const uchar *data = size > 0 ? file.map(0, size) : nullptr;
+    std::optional<Diagram> diagram = data != nullptr ? importDiagramText(QByteArrayView(data, size), errorMessage) : importDiagramText(file.readAll(), errorMessage);
+    if(!diagram.has_value() && errorMessage != nullptr){
+        *errorMessage = fileName + ": " + *errorMessage;
+    }
+    return diagram;
+}
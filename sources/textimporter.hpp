@@ -0,0 +1,25 @@
+#ifndef TEXTIMPORTER_H
+#define TEXTIMPORTER_H
+
+#include <QByteArrayView>
+#include <QString>
+
+#include <optional>
+
+#include "diagram.hpp"
+
+//Importer for diagrams described as text (FDT files), so that diagrams can be generated by scripts instead of being drawn by hand. Each line describes one particle:
+//
+//    #Comments start with a hash sign
+//    point a 0,0                       #Gives a name to a point without drawing anything there
+//    vertex b 200,0 "V"                #Draws a vertex and gives a name to its point, the name is optional
+//    fermion -200,-100 a "e^-"         #Endpoints are either coordinates or names, labels are LaTeX code in double quotes
+//    photon a b "\gamma"
+//    weakboson b 400,100
+//
+//In a label, \" stands for a double quote and \\ for a backslash, other backslashes are kept as they are. The particle types are the names of Particle::ParticleType in any case. Coordinates are in the same units as in the editor, where the grid has a spacing of 100.
+//The text is parsed in a single pass without copying it, and the particles are inserted into the diagram as soon as they're parsed. The diagram is reserved from an estimate based on the size of the text.
+std::optional<Diagram> importDiagramText(QByteArrayView text, QString *errorMessage = nullptr);
+std::optional<Diagram> importDiagramTextFile(const QString &fileName, QString *errorMessage = nullptr);
+
+#endif // TEXTIMPORTER_H
@@ -0,0 +1,248 @@
+#include "topology.hpp"
+
+#include <QSet>
+#include <QVector2D>
+
+#include "trace.hpp"
+
+DiagramTopology::DiagramTopology(int gridSize):
+    _gridSize(gridSize),
+    _componentCount(0)
+{}
+
+void DiagramTopology::insert(Diagram::ParticleId id, const std::shared_ptr<const Particle> &particle){
+    if(this->_particles.contains(id)){
+        this->remove(id);
+    }
+    const QPoint from = this->snap(particle->startingPoint());
+    const QPoint to = this->snap(particle->endPoint());
+    this->_particles.insert(id, Incidence{from, to, particle});
+    if(particle->type() == Particle::Vertex){
+        this->addNode(from).vertices.append(id);
+    }
+    else{
+        this->addNode(from).edges.append(id);
+        this->addNode(to).edges.append(id);
+        this->unite(from, to);
+    }
+}
+
+void DiagramTopology::remove(Diagram::ParticleId id){
+    const auto it = this->_particles.constFind(id);
+    if(it == this->_particles.cend()){
+        return;
+    }
+    const Incidence incidence = it.value();
+    this->_particles.erase(it);
+    if(incidence.particle->type() == Particle::Vertex){
+        this->removeFromNode(incidence.from, id, true);
+    }
+    else{
+        //The component may be split in two, which is only checked the next time the components are needed
+        this->markOutdated(incidence.from);
+        this->markOutdated(incidence.to);
+        this->removeFromNode(incidence.from, id, false);
+        this->removeFromNode(incidence.to, id, false);
+    }
+}
+
+void DiagramTopology::rebuild(const Diagram &diagram){
+    TRACE_SCOPE("DiagramTopology::rebuild");
+    this->clear();
+    this->_particles.reserve(diagram.size());
+    for(const Diagram::Entry &entry: diagram){
+        this->insert(entry.id, entry.particle);
+    }
+}
+
+void DiagramTopology::clear(){
+    this->_nodes.clear();
+    this->_particles.clear();
+    this->_sets.clear();
+    this->_componentCount = 0;
+    this->_outdatedRoots.clear();
+    this->_outdatedNodes.clear();
+}
+
+int DiagramTopology::gridSize() const{
+    return this->_gridSize;
+}
+
+QPoint DiagramTopology::snap(const QPoint &point) const{
+    return (QVector2D(point) / this->_gridSize).toPoint() * this->_gridSize;
+}
+
+bool DiagramTopology::contains(const QPoint &point) const{
+    return this->_nodes.contains(this->snap(point));
+}
+
+QList<QPoint> DiagramTopology::nodes() const{
+    return this->_nodes.keys();
+}
+
+qsizetype DiagramTopology::degree(const QPoint &point) const{
+    const auto it = this->_nodes.constFind(this->snap(point));
+    return it == this->_nodes.cend() ? 0 : it->edges.size();
+}
+
+QList<Diagram::ParticleId> DiagramTopology::edges(const QPoint &point) const{
+    return this->_nodes.value(this->snap(point)).edges;
+}
+
+QList<Diagram::ParticleId> DiagramTopology::vertices(const QPoint &point) const{
+    return this->_nodes.value(this->snap(point)).vertices;
+}
+
+QList<QPoint> DiagramTopology::neighbors(const QPoint &point) const{
+    const QPoint node = this->snap(point);
+    QList<QPoint> neighbors;
+    for(Diagram::ParticleId id: this->_nodes.value(node).edges){
+        const Incidence &incidence = *this->_particles.constFind(id);
+        neighbors.append(incidence.from == node ? incidence.to : incidence.from);
+    }
+    return neighbors;
+}
+
+QStringList DiagramTopology::labels(const QPoint &point) const{
+    QStringList labels;
+    for(Diagram::ParticleId id: this->_nodes.value(this->snap(point)).vertices){
+        const QString labelText = this->_particles.constFind(id)->particle->labelText();
+        if(!labelText.isEmpty()){
+            labels.append(labelText);
+        }
+    }
+    return labels;
+}
+
+bool DiagramTopology::areConnected(const QPoint &a, const QPoint &b) const{
+    const QPoint first = this->snap(a), second = this->snap(b);
+    if(!this->_nodes.contains(first) || !this->_nodes.contains(second)){
+        return false;
+    }
+    this->updateComponents();
+    return this->find(first) == this->find(second);
+}
+
+qsizetype DiagramTopology::componentCount() const{
+    this->updateComponents();
+    return this->_componentCount;
+}
+
+QList<QPoint> DiagramTopology::component(const QPoint &point) const{
+    //A breadth-first search only visits the component itself, while the union-find structure would have to check every node
+    const QPoint start = this->snap(point);
+    if(!this->_nodes.contains(start)){
+        return {};
+    }
+    QList<QPoint> component = {start};
+    QSet<QPoint> visited = {start};
+    for(qsizetype i = 0; i < component.size(); i++){
+        for(const QPoint &neighbor: this->neighbors(component[i])){
+            if(!visited.contains(neighbor)){
+                visited.insert(neighbor);
+                component.append(neighbor);
+            }
+        }
+    }
+    return component;
+}
+
+DiagramTopology::Node &DiagramTopology::addNode(const QPoint &point){
+    auto it = this->_nodes.find(point);
+    if(it == this->_nodes.end()){
+        it = this->_nodes.insert(point, Node());
+        //A node that's added back before its outdated component is recomputed is still part of that component
+        if(!this->_sets.contains(point)){
+            this->_sets.insert(point, Set{point});
+            this->_componentCount++;
+        }
+    }
+    return it.value();
+}
+
+void DiagramTopology::removeFromNode(const QPoint &point, Diagram::ParticleId id, bool isVertex){
+    const auto it = this->_nodes.find(point);
+    Node &node = it.value();
+    (isVertex ? node.vertices : node.edges).removeOne(id);
+    if(node.edges.isEmpty() && node.vertices.isEmpty()){
+        //Other nodes may still point to this one in the union-find structure, so its set is only removed when its component is recomputed
+        this->markOutdated(point);
+        this->_nodes.erase(it);
+    }
+}
+
+void DiagramTopology::markOutdated(const QPoint &point){
+    this->_outdatedRoots.insert(this->find(point));
+    this->_outdatedNodes.insert(point);
+}
+
+QPoint DiagramTopology::find(const QPoint &point) const{
+    QPoint root = point;
+    while(this->_sets.constFind(root)->parent != root){
+        root = this->_sets.constFind(root)->parent;
+    }
+    //Path compression, which together with union by rank keeps the trees almost flat
+    QPoint current = point;
+    while(current != root){
+        Set &set = *this->_sets.find(current);
+        current = set.parent;
+        set.parent = root;
+    }
+    return root;
+}
+
+void DiagramTopology::unite(const QPoint &a, const QPoint &b) const{
+    const QPoint rootA = this->find(a), rootB = this->find(b);
+    if(rootA == rootB){
+        return;
+    }
+    Set &setA = *this->_sets.find(rootA);
+    Set &setB = *this->_sets.find(rootB);
+    QPoint root = rootA;
+    if(setA.rank < setB.rank){
+        setA.parent = rootB;
+        root = rootB;
+    }
+    else{
+        setB.parent = rootA;
+        if(setA.rank == setB.rank){
+            setA.rank++;
+        }
+    }
+    this->_componentCount--;
+
+    //Merging an outdated component with another one makes the merged component outdated
+    const bool outdatedA = this->_outdatedRoots.remove(rootA);
+    const bool outdatedB = this->_outdatedRoots.remove(rootB);
+    if(outdatedA || outdatedB){
+        this->_outdatedRoots.insert(root);
+    }
+}
+
+void DiagramTopology::updateComponents() const{
+    if(this->_outdatedRoots.isEmpty()){
+        return;
+    }
+    TRACE_SCOPE("DiagramTopology::updateComponents");
+    //Each outdated component is replaced by the components found by searching from the nodes that lost an edge, so the rest of the diagram isn't visited
+    this->_componentCount -= this->_outdatedRoots.size();
+    QSet<QPoint> visited;
+    for(const QPoint &start: std::as_const(this->_outdatedNodes)){
+        if(visited.contains(start) || !this->_nodes.contains(start)){
+            continue;
+        }
+        const QList<QPoint> component = this->component(start);
+        for(const QPoint &node: component){
+            visited.insert(node);
+            this->_sets.insert(node, Set{start, node == start && component.size() > 1 ? 1 : 0});
+        }
+        this->_componentCount++;
+    }
+    for(const QPoint &node: std::as_const(this->_outdatedNodes)){
+        if(!this->_nodes.contains(node)){
+            this->_sets.remove(node);
+        }
+    }
+    this->_outdatedRoots.clear();
+    this->_outdatedNodes.clear();
+}
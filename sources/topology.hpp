@@ -0,0 +1,75 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <QHash>
+#include <QList>
+#include <QPoint>
+#include <QSet>
+#include <QStringList>
+
+#include <memory>
+
+#include "diagram.hpp"
+#include "particle.hpp"
+
+//Index of how the particles of a diagram are connected, kept up to date as particles are inserted and removed.
+//The nodes are the points of the grid where particles start or end. Every particle except vertices is an edge between the nodes of its endpoints, vertices only mark a node (usually to give it a label).
+//Connected components are tracked with a union-find structure. Unions can't be undone, so removing an edge only marks its component as outdated. The next time the components are needed, only the outdated components are recomputed, by searching from the endpoints of the removed edges.
+class DiagramTopology{
+public:
+    explicit DiagramTopology(int gridSize);
+
+    void insert(Diagram::ParticleId id, const std::shared_ptr<const Particle> &particle);
+    void remove(Diagram::ParticleId id);
+    void rebuild(const Diagram &diagram);
+    void clear();
+
+    int gridSize() const;
+    QPoint snap(const QPoint &point) const;
+    bool contains(const QPoint &point) const;
+    QList<QPoint> nodes() const;
+
+    qsizetype degree(const QPoint &point) const;
+    QList<Diagram::ParticleId> edges(const QPoint &point) const;
+    QList<Diagram::ParticleId> vertices(const QPoint &point) const;
+    QList<QPoint> neighbors(const QPoint &point) const;
+    QStringList labels(const QPoint &point) const;
+
+    bool areConnected(const QPoint &a, const QPoint &b) const;
+    qsizetype componentCount() const;
+    QList<QPoint> component(const QPoint &point) const;
+
+private:
+    struct Node{
+        QList<Diagram::ParticleId> edges, vertices;    //An edge whose endpoints are the same node is listed twice
+    };
+
+    //Entry of the union-find structure. The entries of removed nodes are kept until the outdated components are recomputed, since other nodes may still point to them.
+    struct Set{
+        QPoint parent;
+        int rank = 0;
+    };
+
+    struct Incidence{
+        QPoint from, to;
+        std::shared_ptr<const Particle> particle;
+    };
+
+    Node &addNode(const QPoint &point);
+    void removeFromNode(const QPoint &point, Diagram::ParticleId id, bool isVertex);
+    void markOutdated(const QPoint &point);
+    QPoint find(const QPoint &point) const;
+    void unite(const QPoint &a, const QPoint &b) const;
+    void updateComponents() const;
+
+    int _gridSize;
+    QHash<QPoint, Node> _nodes;
+    QHash<Diagram::ParticleId, Incidence> _particles;
+
+    mutable QHash<QPoint, Set> _sets;
+    mutable qsizetype _componentCount;    //Number of sets in the union-find structure, which is the number of components once the outdated ones are recomputed
+    mutable QSet<QPoint> _outdatedRoots;    //Roots of the components that lost an edge or a node
+    mutable QSet<QPoint> _outdatedNodes;    //Nodes that lost an edge or were removed, every remaining node of an outdated component is connected to one of them
+};
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,161 @@
+#include "trace.hpp"
+
+#include <QCoreApplication>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+#include <array>
+#include <chrono>
+#include <memory>
+
+//The fields are atomic because a reader may copy an event while the owner of the buffer overwrites it, in which case the copy is thrown away
+struct TraceEvent{
+    std::atomic<const char*> name;
+    std::atomic<qint64> start, end;
+};
+
+struct TraceBlock{
+    static constexpr quint64 size = 1 << 10;
+
+    std::array<TraceEvent, size> events;
+};
+
+//Only the thread that owns the buffer writes to it. The events are stored in blocks that are allocated as they're needed, so that threads that only record a few events don't take the memory of a whole buffer.
+//The owner counts the events before and after writing them, like a sequence lock: readers use the second count to know which events are complete, and check the first count after copying them to drop the ones that were overwritten in the meantime.
+struct TraceBuffer{
+    static constexpr quint64 capacity = 1 << 16;
+
+    ~TraceBuffer(){
+        for(const std::atomic<TraceBlock*> &block: this->blocks){
+            delete block.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::array<std::atomic<TraceBlock*>, capacity / TraceBlock::size> blocks = {};
+    std::atomic<quint64> startedCount = 0;
+    std::atomic<quint64> count = 0;
+    std::atomic<quint64> firstEvent = 0;    //Events before this one were cleared
+    std::atomic<bool> isFinished = false;    //Set when the thread that owns the buffer exits
+    int threadId;
+    QString threadName;
+};
+
+//Marks the buffer of a thread as finished when the thread exits
+struct TraceBufferOwner{
+    std::shared_ptr<TraceBuffer> buffer;
+
+    ~TraceBufferOwner(){
+        this->buffer->isFinished.store(true, std::memory_order_release);
+    }
+};
+
+QMutex traceBuffersMutex;
+QList<std::shared_ptr<TraceBuffer>> traceBuffers;    //Kept after their thread exits so that their events can still be written, until the events are cleared
+int nextTraceThreadId = 1;
+
+QByteArray escapeJson(const QByteArray &text){
+    QByteArray toReturn;
+    toReturn.reserve(text.size());
+    for(char c: text){
+        if(c == '"' || c == '\\'){
+            toReturn += '\\';
+            toReturn += c;
+        }
+        else if(uchar(c) < 0x20){
+            toReturn += "\\u00" + QByteArray::number(uchar(c), 16).rightJustified(2, '0');
+        }
+        else{
+            toReturn += c;
+        }
+    }
+    return toReturn;
+}
+
+TraceBuffer *currentTraceBuffer(){
+    //The mutex is only locked the first time each thread records something
+    thread_local TraceBufferOwner owner{[](){
+        std::shared_ptr<TraceBuffer> newBuffer = std::make_shared<TraceBuffer>();
+        newBuffer->threadName = QCoreApplication::instance() != nullptr && QThread::currentThread() == QCoreApplication::instance()->thread() ? QString("GUI thread") : QThread::currentThread()->objectName();
+        const QMutexLocker locker(&traceBuffersMutex);
+        newBuffer->threadId = nextTraceThreadId++;
+        traceBuffers.append(newBuffer);
+        return newBuffer;
+    }()};
+    return owner.buffer.get();
+}
+
+void Trace::setEnabled(bool enabled){
+    _enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Trace::clear(){
+    const QMutexLocker locker(&traceBuffersMutex);
+    //Threads that have exited will never record anything again, so their buffers are freed instead of being cleared. Otherwise thread pool threads, which come and go, would keep adding buffers.
+    traceBuffers.removeIf([](const std::shared_ptr<TraceBuffer> &buffer){
+        return buffer->isFinished.load(std::memory_order_acquire);
+    });
+    for(const std::shared_ptr<TraceBuffer> &buffer: std::as_const(traceBuffers)){
+        buffer->firstEvent.store(buffer->count.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+bool Trace::writeChromeJson(QIODevice *device){
+    const QMutexLocker locker(&traceBuffersMutex);
+    const QByteArray processId = QByteArray::number(QCoreApplication::applicationPid());
+    bool ok = device->write("{\"traceEvents\":[") != -1;
+    bool isFirst = true;
+    for(const std::shared_ptr<TraceBuffer> &buffer: std::as_const(traceBuffers)){
+        const QByteArray threadId = QByteArray::number(buffer->threadId);
+        QByteArray json = isFirst ? "" : ",";
+        isFirst = false;
+        json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + processId + ",\"tid\":" + threadId + ",\"args\":{\"name\":\"" + escapeJson(buffer->threadName.isEmpty() ? "Thread " + threadId : buffer->threadName.toUtf8()) + "\"}}";
+
+        //The events are copied first, since the owner may overwrite some of them while they're being copied
+        const quint64 count = buffer->count.load(std::memory_order_acquire);
+        const quint64 first = qMax(buffer->firstEvent.load(std::memory_order_relaxed), count > TraceBuffer::capacity ? count - TraceBuffer::capacity : 0);
+        struct EventCopy{
+            const char *name;
+            qint64 start, end;
+        };
+        QList<EventCopy> events;
+        events.reserve(qsizetype(count - first));
+        for(quint64 i = first; i < count; i++){
+            const TraceEvent &event = buffer->blocks[i / TraceBlock::size % buffer->blocks.size()].load(std::memory_order_acquire)->events[i % TraceBlock::size];
+            events.append(EventCopy{event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed), event.end.load(std::memory_order_relaxed)});
+        }
+        //An event that was overwritten while it was copied was started at least a whole capacity after it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const quint64 startedCount = buffer->startedCount.load(std::memory_order_relaxed);
+        const quint64 firstValid = startedCount > TraceBuffer::capacity ? startedCount - TraceBuffer::capacity : 0;
+
+        for(quint64 i = qMax(first, firstValid); i < count; i++){
+            //Timestamps are in microseconds in the Chrome format
+            const EventCopy &event = events[qsizetype(i - first)];
+            json += ",{\"name\":\"" + escapeJson(event.name) + "\",\"ph\":\"X\",\"pid\":" + processId + ",\"tid\":" + threadId + ",\"ts\":" + QByteArray::number(event.start / 1000.0, 'f', 3) + ",\"dur\":" + QByteArray::number((event.end - event.start) / 1000.0, 'f', 3) + "}";
+        }
+        ok = ok && device->write(json) != -1;
+    }
+    return ok && device->write("]}") != -1;
+}
+
+qint64 Trace::now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::record(const char *name, qint64 start, qint64 end){
+    TraceBuffer *buffer = currentTraceBuffer();
+    const quint64 index = buffer->count.load(std::memory_order_relaxed);
+    std::atomic<TraceBlock*> &block = buffer->blocks[index / TraceBlock::size % buffer->blocks.size()];
+    if(block.load(std::memory_order_relaxed) == nullptr){
+        block.store(new TraceBlock(), std::memory_order_release);
+    }
+    //The event is counted as started before it's written, so that a reader that copies part of it knows it may have been overwritten
+    buffer->startedCount.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    TraceEvent &event = block.load(std::memory_order_relaxed)->events[index % TraceBlock::size];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+    buffer->count.store(index + 1, std::memory_order_release);
+}
@@ -0,0 +1,48 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QIODevice>
+
+#include <atomic>
+
+//Lightweight tracing to see where time goes, for example between a mouse event and the repaint.
+//Spans are recorded into a ring buffer owned by the thread that records them, so recording never takes a lock. When tracing is disabled, a span only costs one relaxed atomic load.
+//The recorded spans can be written in the Chrome trace event format, which can be opened in chrome://tracing or Perfetto.
+class Trace{
+public:
+    static bool isEnabled(){
+        return _enabled.load(std::memory_order_relaxed);
+    }
+    static void setEnabled(bool enabled);
+    static void clear();
+    static bool writeChromeJson(QIODevice *device);
+
+    static qint64 now();
+    static void record(const char *name, qint64 start, qint64 end);
+
+private:
+    static inline std::atomic<bool> _enabled = false;
+};
+
+class TraceSpan{
+public:
+    explicit TraceSpan(const char *name): _name(name), _start(Trace::isEnabled() ? Trace::now() : -1){}
+    ~TraceSpan(){
+        if(this->_start >= 0){
+            Trace::record(this->_name, this->_start, Trace::now());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan &operator=(const TraceSpan&) = delete;
+
+private:
+    const char *_name;    //Must be a string literal, since only the pointer is stored
+    qint64 _start;
+};
+
+#define TRACE_CONCATENATE_(a, b) a##b
+#define TRACE_CONCATENATE(a, b) TRACE_CONCATENATE_(a, b)
+#define TRACE_SCOPE(name) const TraceSpan TRACE_CONCATENATE(traceSpan, __LINE__)(name)
+
+#endif // TRACE_H